@@ -14,6 +14,7 @@
 #include "util.h"
 
 #include "storage.h"
+#include "events.h"
 #include "digital_pressure.h"
 #include "temperature.h"
 #include "gsm.h"
@@ -32,17 +33,20 @@
 const ubyte *global_help_string = \
 "Please enter one of the following commands:\r\n" \
 "a    Send AT command to GSM modem.\r\n" \
+"b    Benchmark EEPROM throughput at each I2C bus speed.\r\n" \
 "c    View and/or set the GSM PIN.\r\n" \
 "C    Compose a test SMS message and send it.\r\n" \
-"d    Dump all logged records from the EEPROM to the serial.\r\n" \
+"d    Dump all logged records (JSON) or the raw EEPROM image (binary) to the serial.\r\n" \
+"e    Display the event journal.\r\n" \
+"f    Find logged records by time (hh:mm[:ss][-hh:mm[:ss]]) or altitude (m[-m]) range.\r\n" \
 "g    Enable GSM and view status.\r\n" \
 "G    Configure the GSM phone number to send SMS to.\r\n" \
 "h    Test whether the GSM modem is ready to send SMS messages.\r\n" \
 "H    Disable GSM.\r\n" \
 "l    Switch to flight mode and start logging.\r\n" \
-"L    Display the number of the last logged record.\r\n" \
+"L    Display the number of the last logged record, the read cache and UART counters.\r\n" \
 "n    Display a particular record.\r\n" \
-"N    Wipe the complete EEPROM.\r\n" \
+"N    Wipe the logged records (the configuration and the event journal are kept).\r\n" \
 "p    Display analog and digital pressures.\r\n" \
 "P    Retrieve BMP180 coefficients.\r\n" \
 "q    Display position and GPS status.\r\n" \
@@ -65,8 +69,14 @@ static void cmd_pressure(void);
 static void cmd_position(void);
 static void cmd_storage(void);
 static void cmd_dump_storage(void);
+static void cmd_find_records(void);
+static void cmd_events(void);
+static ubyte *parse_range_value(ubyte *s, sint32 *v);
 static void cmd_launch(void);
 static void cmd_print_record(void);
+static void cmd_last_record(void);
+static void cmd_i2c_benchmark(void);
+static uint16 bench_ticks(void);
 static void cmd_cut_parachute(void);
 static void cmd_test_sms(void);
 static void cmd_sms_ready(void);
@@ -98,12 +108,18 @@ void command_loop(void)
         switch (c) {
             case 'a':       // Run an AT command:
                 cmd_at_command(); break;
+            case 'b':       // Measure EEPROM throughput at 100 and 400 kHz
+                cmd_i2c_benchmark(); break;
             case 'c':       // Set the GSM PIN number
                 cmd_phone_pin(); break;
             case 'C':       // Send test SMS using GSM.
                 cmd_test_sms(); break;
             case 'd':       // Dump all logged records
                 cmd_dump_storage(); break;
+            case 'e':       // Display the event journal
+                cmd_events(); break;
+            case 'f':       // Find logged records in a time or altitude range
+                cmd_find_records(); break;
             case 'g':       // Enable GSM and view status
                 enable_gsm(); break;
             case 'G':       // Configure the GSM phone number to send position sms to
@@ -115,8 +131,7 @@ void command_loop(void)
             case 'l':       // Switch to launch mode and reset
                 cmd_launch(); break;
             case 'L':
-                printf("Last logged telemetry record: %u\r\n", global_config.ru.config.last_record);
-                break;
+                cmd_last_record(); break;
             case 'n':
                 cmd_print_record(); break;
             case 'N':
@@ -212,7 +227,7 @@ static void cmd_phone_number(void)
         for (i = 0; i < (ubyte)SIZE_CELL_NUMBER; i++) {
             global_config.ru.config.cell_number[i] = buf[i];
         }
-        save_record(0, &global_config);
+        save_config();
         printf("OK\r\n");
     }
 }
@@ -224,7 +239,7 @@ static void cmd_pressure(void)
     bmp180_coeff coeff;
 
     // 1. Print out the BMP085 coefficients:
-    read_bmp180_coefficients(&coeff);
+    if (!read_bmp180_coefficients(&coeff)) { printf("No valid coefficients were read at init.\r\n"); }
     printf("The BMP085's coefficients are:\r\n");
     printf("AC1: %d\r\n", coeff.ac1);
     printf("AC2: %d\r\n", coeff.ac2);
@@ -244,9 +259,9 @@ static void cmd_pressure(void)
  */
 static void cmd_position(void)
 {
-    gps_pos pos;
-    get_position(&pos);
-    print_position(&pos);
+    gps_fix fix;
+    if (!get_position(&fix, GPS_DEADLINE_MS)) { printf("No GPS data, last valid fix:"); }
+    print_position(&fix);
 }
 
 
@@ -280,14 +295,27 @@ static void cmd_storage(void)
 
 static void cmd_dump_storage(void)
 {
-    uint16 r, num_records;
+    uint16 r, first, num_records;
     record rec;
+    ubyte buf[APC_BUF_SIZE];
+
+    // A byte offset selects the binary dump of the raw EEPROM image (see tools/dump_image.c):
+    printf("Type byte offset for a binary dump, or nothing for a JSON dump of the records: ");
+    alt_gets(buf, sizeof(buf) - 1);
+    if (buf[0] != '\0') {
+        printf("\r\n");
+        if (!dump_storage((uint24)atol(buf))) { printf("\r\nError reading EEPROM\r\n"); }
+        return;
+    }
+    printf("\r\n");
     
-    num_records = global_config.ru.config.last_record;
-    printf("{\"number of records\": %u,\r\n\"records\": [", num_records);
+    // Walk the log ring from the oldest record that has not been overwritten to the newest:
+    if (!oldest_record(&first)) { first = 1; }
+    num_records = global_config.ru.config.last_record + 1 - first;
+    printf("{\"first record\": %u,\r\n\"number of records\": %u,\r\n\"records\": [", first, num_records);
     
-    for (r = 1; r <= num_records && r < (RECORDS_PER_BLOCK * 2); r++) {
-        retr_record(r, &rec);
+    for (r = 0; r < num_records; r++) {
+        if (!retr_record(first + r, &rec)) { continue; }
         print_record(&rec);
         printf(",\r\n");
         ClrWdt();
@@ -296,6 +324,115 @@ static void cmd_dump_storage(void)
 }
 
 
+/**
+ * Display the event journal, oldest event first (see tools/decode_events.c for the host decoder).
+ */
+static void cmd_events(void)
+{
+    static const char *names[EVENT_IDS] = EVENT_NAMES;
+    event_entry e;
+    uint16 i, n;
+
+    if (!flush_events()) { printf("Error writing events\r\n"); }
+    n = events_stored();
+    printf("%u events\r\n", n);
+    for (i = 0; i < n; i++) {
+        if (!read_event(i, &e)) { printf("Error reading event %u\r\n", i); continue; }
+        printf("%5u  record %5u  %5u ms  %-10s %u\r\n", e.seq, e.record, e.ms, names[e.id], e.payload);
+
+        // Clear watchdog timer and check if user entered anything
+        ClrWdt();
+        if (data_rdy_uart()) { return; }
+    }
+}
+
+
+#define FIND_BUF_SIZE   20
+
+/**
+ * Prompt for a time or an altitude range and display the logged records in it. The log index is
+ * used to read only the log pages that hold matching records. A single time selects that minute
+ * (or second), a single altitude everything above it.
+ */
+static void cmd_find_records(void)
+{
+    log_query q;
+    record rec;
+    uint16 num, found = 0;
+    sint32 from, to;
+    ubyte buf[FIND_BUF_SIZE];
+    ubyte *s;
+
+    printf("Type time range (hh:mm[:ss][-hh:mm[:ss]], UTC on the launch day) or altitude range (m[-m]): ");
+    alt_gets(buf, sizeof(buf) - 1);
+    printf("\r\n");
+
+    s = parse_range_value(buf, &from);
+    if (s == NULL) {
+        printf("Illegal range entered.\r\n");
+        return;
+    }
+    if (*s == '-') {
+        if (parse_range_value(s + 1, &to) == NULL) {
+            printf("Illegal range entered.\r\n");
+            return;
+        }
+    }
+    else if (strchr(buf, ':') == NULL) { to = SHRTLONG_MAX; }
+    else { to = from + ((strchr(strchr(buf, ':') + 1, ':') == NULL) ? 59 : 0); }
+
+    // Only the range that was entered restricts the query:
+    memset(&q, '\0', sizeof(q));
+    q.time_from = 0;
+    q.time_to = SHRTLONG_MAX;
+    q.alt_from = SHRTLONG_MIN;
+    q.alt_to = SHRTLONG_MAX;
+    if (strchr(buf, ':') != NULL) {
+        q.time_from = (uint24)from;
+        q.time_to = (uint24)to;
+    }
+    else {
+        q.alt_from = (sint24)from;
+        q.alt_to = (sint24)to;
+    }
+
+    if (!query_log(&q)) {
+        printf("Error reading EEPROM\r\n");
+        return;
+    }
+    while (query_next(&q, &num, &rec)) {
+        printf("Record %u: ", num);
+        print_record(&rec);
+        found++;
+        ClrWdt();
+    }
+    printf("%u records found, %u log pages read\r\n", found, q.pages);
+}
+
+
+/**
+ * Parse a time (hh:mm[:ss]) into seconds, or an altitude in meters.
+ * @param s The text
+ * @param v The value
+ * @return The text following the value, or NULL if there is no value
+ */
+static ubyte *parse_range_value(ubyte *s, sint32 *v)
+{
+    char *end;
+    ubyte parts = 1;
+
+    *v = strtol((char *)s, &end, 10);
+    if (end == (char *)s) { return NULL; }
+    while (*end == ':' && parts < 3) {
+        s = (ubyte *)end + 1;
+        *v = *v * 60 + strtol((char *)s, &end, 10);
+        parts++;
+    }
+    if (parts == 2) { *v *= 60; }   // hh:mm
+    return (ubyte *)end;
+}
+
+
 /**
  *
  */
@@ -307,11 +444,13 @@ static void cmd_launch(void)
     disable_gsm();  // Make sure GSM is disabled (also clears gsm_on bit in global status)
 
     global_config.ru.config.mode = MODE_PRELAUNCH;
-    global_config.ru.config.last_record = 0;  // Start logging
+    event_log(EVENT_MODE, MODE_PRELAUNCH);
+    flush_events();
+    start_log(DEFAULT_LOG_FORMAT);  // Start logging (writes out records buffered from a previous flight)
     set_print_launch_time();    // Determine exact launch time and record    
     
     // Save the global record:
-    save_record(0, &global_config);
+    save_config();
 
     // Reset mission clock and reset probe computer:
     Reset();
@@ -320,24 +459,19 @@ static void cmd_launch(void)
 
 static void set_print_launch_time(void)
 {
-    gps_pos pos;
-    ubyte buf[3];
+    gps_fix fix;
     
-    // Retrieve launch time:
-    get_position(&pos);
-    
-    buf[0] = pos.time[0];
-    buf[1] = pos.time[1];
-    buf[2] = '\0';
-    global_config.ru.config.l_hours = (ubyte)atoi(buf);
-    buf[0] = pos.time[2];
-    buf[1] = pos.time[3];
-    buf[2] = '\0';
-    global_config.ru.config.l_minutes = (ubyte)atoi(buf);
-    buf[0] = pos.time[4];
-    buf[1] = pos.time[5];
-    buf[2] = '\0';
-    global_config.ru.config.l_seconds = (ubyte)atoi(buf);
+    // Retrieve launch time, a stale fix would give the wrong one:
+    if (!get_position(&fix, GPS_DEADLINE_MS)) {
+        printf("No GPS fix, launch time %u:%u:%u UTC kept\r\n", \
+                global_config.ru.config.l_hours, \
+                global_config.ru.config.l_minutes, \
+                global_config.ru.config.l_seconds);
+        return;
+    }
+    global_config.ru.config.l_hours = fix.hours;
+    global_config.ru.config.l_minutes = fix.minutes;
+    global_config.ru.config.l_seconds = fix.seconds;
     printf("Launch time %u:%u:%u UTC\r\n", \
             global_config.ru.config.l_hours, \
             global_config.ru.config.l_minutes, \
@@ -347,19 +481,20 @@ static void set_print_launch_time(void)
 
 static void cmd_print_record(void)
 {
-    uint16 tmp;
+    uint16 tmp, first;
     ubyte buf[APC_BUF_SIZE];
     record rec;
     memset(buf, '\0', sizeof(buf));
 
-    printf("Type record number to retrieve (1 to %u) (record is %u bytes): ", (uint16)(RECORDS_PER_BLOCK * 2 - 1), sizeof(record));
+    if (!oldest_record(&first)) { first = 1; }
+    printf("Type record number to retrieve (%u to %u): ", first, global_config.ru.config.last_record);
     alt_gets(buf, sizeof(buf) - 1);    // We allow the user only to enter 7 chars (ensure null-termination)
     tmp = (uint16)atol(buf);
 
-    if (tmp > 0 && tmp < (RECORDS_PER_BLOCK * 2)) {
+    if (tmp >= first && tmp <= global_config.ru.config.last_record) {
         printf("\r\nRetrieving record %u\r\n", tmp);
-        retr_record(tmp, &rec);
-        print_record(&rec);
+        if (retr_record(tmp, &rec)) { print_record(&rec); }
+        else { printf("Error reading record\r\n"); }
     }
     else {
         printf("\r\nIllegal record number entered.\r\n");
@@ -367,6 +502,79 @@ static void cmd_print_record(void)
 }
 
 
+static void cmd_last_record(void)
+{
+    uint16 hits, misses;
+
+    read_cache_stats(&hits, &misses);
+    printf("Last logged telemetry record: %u\r\n", global_config.ru.config.last_record);
+    printf("Page read cache: %u hits, %u misses\r\n", hits, misses);
+    printf("UART receive: %u bytes lost, %u framing errors\r\n", global_uart_overflows, global_uart_framing_errors);
+}
+
+
+#define BENCH_PAGES 16
+#define BENCH_ADDR  (I2C_24LC1026_BLOCK_SIZE - I2C_24LC1026_PAGE_SIZE)  // Last page of the high block
+#define BENCH_TICKS_PER_SEC 19531   // Timer0 at Fosc / 4 with a 1:256 prescaler
+static void cmd_i2c_benchmark(void)
+{
+    // The page is written with its own contents, so the benchmark leaves the EEPROM as it was:
+    static ubyte page[I2C_24LC1026_PAGE_SIZE];
+    uint32 bytes = (uint32)BENCH_PAGES * I2C_24LC1026_PAGE_SIZE;
+    uint16 t;
+    ubyte speed, i;
+
+    if (!i2c_eeprom_sequence_read(BENCH_ADDR, I2C_24LC1026_HIGH_BLK, page, I2C_24LC1026_PAGE_SIZE)) {
+        printf("Error reading EEPROM\r\n");
+        return;
+    }
+    T0CON = 0x87;   // Timer0 on, 16 bits, Fosc / 4 with a 1:256 prescaler (51.2 us per tick)
+
+    for (speed = 0; speed < I2C_SPEEDS; speed++) {
+        i2c_set_speed(I2C_EEPROM_ADDR, speed);
+        printf("%s kHz: ", (speed == I2C_SPEED_100KHZ) ? "100" : "400");
+
+        // Sequential reads of a full page:
+        bench_ticks();
+        for (i = 0; i < BENCH_PAGES; i++) {
+            if (!i2c_eeprom_sequence_read(BENCH_ADDR, I2C_24LC1026_HIGH_BLK, page, I2C_24LC1026_PAGE_SIZE)) { break; }
+        }
+        t = bench_ticks();
+        if (i < BENCH_PAGES) { printf("read error "); }
+        else { printf("sequence read %lu bytes/s, ", bytes * BENCH_TICKS_PER_SEC / (t ? t : 1)); }
+
+        // Page writes, including the write cycle (ack polling):
+        bench_ticks();
+        for (i = 0; i < BENCH_PAGES; i++) {
+            if (!i2c_eeprom_page_write(BENCH_ADDR, I2C_24LC1026_HIGH_BLK, page, I2C_24LC1026_PAGE_SIZE, TRUE)) { break; }
+        }
+        t = bench_ticks();
+        if (i < BENCH_PAGES) { printf("write error\r\n"); }
+        else { printf("page write %lu bytes/s\r\n", bytes * BENCH_TICKS_PER_SEC / (t ? t : 1)); }
+        ClrWdt();
+    }
+
+    T0CON = 0x00;   // Timer0 off
+    i2c_set_speed(I2C_EEPROM_ADDR, I2C_EEPROM_SPEED);
+}
+
+
+/**
+ * Read and restart Timer0.
+ * @return Number of ticks since the previous call
+ */
+static uint16 bench_ticks(void)
+{
+    uint16 t;
+
+    t = TMR0L;                  // Reading TMR0L latches TMR0H
+    t |= (uint16)TMR0H << 8;
+    TMR0H = 0;                  // Written to TMR0 together with TMR0L
+    TMR0L = 0;
+    return t;
+}
+
+
 static void cmd_cut_parachute(void)
 {
     printf("Testing parachute deployment mechanism...");
@@ -402,7 +610,7 @@ static void cmd_phone_pin(void)
         for (i = 0; i < (ubyte)SIZE_PHONE_PIN; i++) {
             global_config.ru.config.phone_pin[i] = buf[i];
         }
-        save_record(0, &global_config);
+        save_config();
         printf("OK\r\n");
     }
 }
@@ -527,7 +735,7 @@ static void cmd_radio_invert(void)
     if (c == 'y') {
         global_config.ru.config.radio_invert = (global_config.ru.config.radio_invert) ? 0: 1;
         
-        save_record(0, &global_config);
+        save_config();
         if (global_config.ru.config.radio_invert) { printf("Radio RTTY is now inverted.\r\n"); }
         else { printf("Radio RTTY is now NOT inverted.\r\n"); }
     }    
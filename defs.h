@@ -15,8 +15,12 @@ extern "C" {
 // We use a clock frequency of 20 MHz:
 #define _XTAL_FREQ 20000000
 
+#ifdef __XC8
 #include <xc.h>
 #include <p18f4550.h>      // IDE will instruct compiler what to use
+#else
+#include "host.h"           // Host builds of the storage code, see tools/host.h
+#endif
 
 // More verbose debugging information:
 #define DEBUG_ON 1
@@ -41,10 +45,17 @@ typedef unsigned char       ubyte;  // [0 - 255]
 typedef signed char         sbyte;  // [-128 - 127]
 typedef short               sint16; // [-32768 - 32767]
 typedef unsigned short      uint16; // [0 - 65536]
+#ifdef __XC8
 typedef short long          sint24; // [-8388608 - 8388607]
 typedef unsigned short long uint24; // [0 - 16777215]
 typedef long                sint32; // [-2147483648 - 2147483647]
 typedef unsigned long       uint32; // [0 - 4294967295]
+#else
+typedef int                 sint24; // No 24-bit type on the host
+typedef unsigned int        uint24;
+typedef int                 sint32;
+typedef unsigned int        uint32;
+#endif
 
 
 // Flight status definitions:
@@ -10,15 +10,30 @@
 #include "digital_pressure.h"
 
 #include "i2c.h"
+#include "util.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <limits.h>
 
 
+#define BMP180_COEFF_REG    0xAA    // First of the 11 big-endian calibration words (0xAA - 0xBF)
+#define BMP180_COEFF_LEN    22
+
+// Maximum conversion times (datasheet), rounded up to whole ms:
+#define BMP180_TEMP_MS      5       // 4.5 ms
+static const ubyte conversion_ms[4] = { 5, 8, 14, 26 };    // Pressure by oversampling setting: 4.5, 7.5, 13.5 and 25.5 ms
+
 // Function prototypes
-static uint16 read_coeff(ubyte reg_addr_h, ubyte reg_addr_l);
+static ubyte  read_regs(ubyte reg, ubyte *buf, ubyte len);
+static ubyte  load_coefficients(void);
 static sint32 read_sensor(ubyte pressure_reading, ubyte oss);
+static sint32 true_b5(sint32 ut);
+static uint24 true_pressure(sint32 up, sint32 b5, ubyte oss);
+
+// Calibration coefficients, read once by init_bmp180_pressure() (they are factory constants):
+static bmp180_coeff bmp_coeff;
+static ubyte bmp_coeff_ok = FALSE;  // True iff bmp_coeff holds valid coefficients
 
 
 ubyte init_bmp180_pressure(void)
@@ -27,7 +42,7 @@ ubyte init_bmp180_pressure(void)
 
     // Per datasheet, check data communication by reading address 0
     dummy = read_sensor(TRUE, 0);
-    if (dummy == LONG_MAX) {
+    if (dummy == LONG_MAX || !load_coefficients()) {
         printf("\r\nError initializing digital barometer\r\n");
         return FALSE;
     }
@@ -36,170 +51,231 @@ ubyte init_bmp180_pressure(void)
 }
 
 
-static uint16 read_coeff(ubyte reg_addr_h, ubyte reg_addr_l)
+/**
+ * Read consecutive registers of the BMP180.
+ * @return True iff the registers were read
+ */
+static ubyte read_regs(ubyte reg, ubyte *buf, ubyte len)
 {
-    uint16 result = 0;
-    ubyte msb, lsb;
-
-    // 1. Read out the MSB of the coefficient:
-    i2c_start();
-    if (!i2c_write(I2C_BMP180_ADDR | I2C_WRITE))    { return USHRT_MAX; }
-    if (!i2c_write(reg_addr_h))                     { return USHRT_MAX; }
-    i2c_restart();
-    if (!i2c_write(I2C_BMP180_ADDR | I2C_READ))     { return USHRT_MAX; }
-    if (!i2c_read(&msb))                            { return USHRT_MAX; }
-    i2c_nack();
-    i2c_stop();
-
-    // 2. Read out the LSB of the coefficient:
-    i2c_start();
-    if (!i2c_write(I2C_BMP180_ADDR | I2C_WRITE))    { return USHRT_MAX; }
-    if (!i2c_write(reg_addr_l))                     { return USHRT_MAX; }
-    i2c_restart();
-    if (!i2c_write(I2C_BMP180_ADDR | I2C_READ))     { return USHRT_MAX; }
-    if (!i2c_read(&lsb))                            { return USHRT_MAX; }
-    i2c_nack();
-    i2c_stop();
+    i2c_txn t;
+
+    memset(&t, 0, sizeof(t));
+    t.addr = I2C_BMP180_ADDR;
+    t.reg[0] = reg;
+    t.reg_len = 1;
+    t.rbuf = buf;
+    t.rlen = len;
+    return (i2c_transfer(&t, I2C_TIMEOUT_MS) == I2C_OK);
+}
 
-    // Process and return the results:
-    result = ((uint16)msb << 8) | (uint16)lsb;
-    return result;
+
+/**
+ * Read the calibration coefficients in a single burst and check them: per the datasheet none of
+ * them is 0x0000 or 0xFFFF, which is what a dead bus or sensor returns.
+ * @return True iff the coefficients were read and are valid
+ */
+static ubyte load_coefficients(void)
+{
+    ubyte buf[BMP180_COEFF_LEN];
+    uint16 w[BMP180_COEFF_LEN / 2];
+    ubyte i;
+
+    bmp_coeff_ok = FALSE;
+    if (!read_regs(BMP180_COEFF_REG, buf, BMP180_COEFF_LEN)) { return FALSE; }
+    for (i = 0; i < BMP180_COEFF_LEN / 2; i++) {
+        w[i] = ((uint16)buf[2 * i] << 8) | buf[2 * i + 1];
+        if (w[i] == 0x0000 || w[i] == 0xFFFF) { return FALSE; }
+    }
+
+    bmp_coeff.ac1 = (sint16)w[0];
+    bmp_coeff.ac2 = (sint16)w[1];
+    bmp_coeff.ac3 = (sint16)w[2];
+    bmp_coeff.ac4 =         w[3];
+    bmp_coeff.ac5 =         w[4];
+    bmp_coeff.ac6 =         w[5];
+    bmp_coeff.b1 =  (sint16)w[6];
+    bmp_coeff.b2 =  (sint16)w[7];
+    bmp_coeff.mb =  (sint16)w[8];
+    bmp_coeff.mc =  (sint16)w[9];
+    bmp_coeff.md =  (sint16)w[10];
+    bmp_coeff_ok = TRUE;
+    return TRUE;
 }
 
 
+/**
+ * Start a temperature or pressure conversion, wait for it to complete and read the result.
+ * @param pressure_reading BMP180_PRESSURE or BMP180_TEMPERATURE
+ * @param oss Oversampling setting of a pressure conversion (BMP180_ULTRA_LOW_PWR ... BMP180_ULTRA_HIGH)
+ * @return The uncompensated value, LONG_MAX on error
+ */
 static sint32 read_sensor(ubyte pressure_reading, ubyte oss)
 {
+    i2c_txn t;
     sint32 result = 0;
-    ubyte msb = 0, lsb = 0, xlsb = 0, val;
+    ubyte data[3] = {0, 0, 0}, val, wait;
+    uint16 start;
 
-    // 0. Determine the correct value for entering at the F4 address:
-    if (pressure_reading) { val = 0x34 + (oss << 6); }
-    else { val = 0x2e; }
+    // 0. Determine the correct value for entering at the F4 address, and the conversion time:
+    if (pressure_reading) {
+        val = 0x34 + (oss << 6);
+        wait = conversion_ms[oss];
+    }
+    else {
+        val = 0x2e;
+        wait = BMP180_TEMP_MS;
+    }
 
     // 1. Start temperature or pressure measurement:
-    i2c_start();
-    if (!i2c_write(I2C_BMP180_ADDR | I2C_WRITE))    { return LONG_MAX; }
-    if (!i2c_write(0xF4))                           { return LONG_MAX; }
-    if (!i2c_write(val))                            { return LONG_MAX; }
-    i2c_stop();
-    __delay_ms(20); __delay_ms(20);  // Delay for 40ms to wait for conversion (we use maximum oversampling)
+    memset(&t, 0, sizeof(t));
+    t.addr = I2C_BMP180_ADDR;
+    t.reg[0] = 0xF4;
+    t.reg_len = 1;
+    t.wbuf = &val;
+    t.wlen = 1;
+    if (i2c_transfer(&t, I2C_TIMEOUT_MS) != I2C_OK) { return LONG_MAX; }
+
+    // Wait for the conversion: a tick may be nearly over when it starts, so one more is waited:
+    start = ms_ticks();
+    while (ms_since(start) <= wait) { Nop(); }
 
     // 2. Read out the results (always registers 0xF6 and 0xF7, optionally 0xF8 for pressure):
-    i2c_start();
-    if (!i2c_write(I2C_BMP180_ADDR | I2C_WRITE))    { return LONG_MAX; }
-    if (!i2c_write(0xF6))                           { return LONG_MAX; }
-    i2c_restart();
-    if (!i2c_write(I2C_BMP180_ADDR | I2C_READ))     { return LONG_MAX; }
-    // Read and ack the MSB and LSB:
-    if (!i2c_read(&msb))                            { return LONG_MAX; }
-    i2c_ack();
-    if (!i2c_read(&lsb))                            { return LONG_MAX; }
-    // Optionally read and ack the XLSB:
-    if (pressure_reading) {
-        i2c_ack();
-        if (!i2c_read(&xlsb))                       { return LONG_MAX; }
-    }
-    i2c_nack();
-    i2c_stop();
+    if (!read_regs(0xF6, data, pressure_reading ? 3 : 2)) { return LONG_MAX; }
 
     // Process and return the results:
     if (pressure_reading) {
-        result = (((sint32)msb << 16) | ((sint32)lsb << 8) | (sint32)xlsb) >> (8 - oss);
+        result = (((sint32)data[0] << 16) | ((sint32)data[1] << 8) | (sint32)data[2]) >> (8 - oss);
     }
     else { // Temperature reading
-        result = ((sint32)msb << 8) | (sint32)lsb;
+        result = ((sint32)data[0] << 8) | (sint32)data[1];
     }
     return result;
 }
 
 
+/**
+ * Copy the calibration coefficients read by init_bmp180_pressure(), or read them now if that did
+ * not run or failed (init() stops at the first subsystem that fails).
+ * @param coeff The coefficients
+ * @return True iff the coefficients are valid
+ */
 ubyte read_bmp180_coefficients(bmp180_coeff *coeff)
 {
-    memset(coeff, '\0', sizeof(coeff));
-
-    // Read out calibration coefficients:
-    coeff->ac1 = (sint16)read_coeff(0xaa, 0xab);
-    coeff->ac2 = (sint16)read_coeff(0xac, 0xad);
-    coeff->ac3 = (sint16)read_coeff(0xae, 0xaf);
-    coeff->ac4 =         read_coeff(0xb0, 0xb1);
-    coeff->ac5 =         read_coeff(0xb2, 0xb3);
-    coeff->ac6 =         read_coeff(0xb4, 0xb5);
-    coeff->b1 =  (sint16)read_coeff(0xb6, 0xb7);
-    coeff->b2 =  (sint16)read_coeff(0xb8, 0xb9);
-    coeff->mb =  (sint16)read_coeff(0xba, 0xbb);
-    coeff->mc =  (sint16)read_coeff(0xbc, 0xbd);
-    coeff->md =  (sint16)read_coeff(0xbe, 0xbf);
+    if (!bmp_coeff_ok) { load_coefficients(); }
+    *coeff = bmp_coeff;
+    return bmp_coeff_ok;
+}
+
 
+/**
+ * Measure temperature and pressure from one temperature conversion, followed by one or more
+ * pressure conversions of which the results are averaged. The calibration coefficients are read
+ * first if init_bmp180_pressure() did not get them.
+ * @param oss Oversampling setting (BMP180_ULTRA_LOW_PWR ... BMP180_ULTRA_HIGH): higher is less
+ *            noisy, but takes longer (4.5 - 25.5 ms per pressure conversion)
+ * @param samples Number of pressure conversions to average (at least 1)
+ * @param temp Temperature in 0.1C
+ * @param pressure Pressure in Pa
+ * @return True iff the sensor could be read
+ */
+ubyte read_bmp180(ubyte oss, ubyte samples, sint16 *temp, uint24 *pressure)
+{
+    sint32 ut, up, b5;
+    ubyte i;
+
+    if (oss > BMP180_ULTRA_HIGH) { return FALSE; }
+    if (!bmp_coeff_ok && !load_coefficients()) { return FALSE; }
+    if (samples == 0) { samples = 1; }
+
+    ut = read_sensor(BMP180_TEMPERATURE, oss);
+    if (ut == LONG_MAX) { return FALSE; }
+    up = 0;
+    for (i = 0; i < samples; i++) {
+        b5 = read_sensor(BMP180_PRESSURE, oss);
+        if (b5 == LONG_MAX) { return FALSE; }
+        up += b5;
+    }
+    up = (up + samples / 2) / samples;
+
+    b5 = true_b5(ut);
+    *temp = (sint16)((b5 + 8) / 16);
+    *pressure = true_pressure(up, b5, oss);
     return TRUE;
 }
 
 
+/**
+ * @return The temperature in 0.1C, SHRT_MAX on error
+ */
 sint16 read_bmp180_temperature(void)
 {
-    bmp180_coeff coeff;
-    sint32 ut, tt, x1, x2, b5;
-    sint16 ret;
+    sint32 ut;
 
-    // 1. Retrieve coefficients and uncompensated temperature and pressure:
-    read_bmp180_coefficients(&coeff);   // TODO: error checking on coefficient readout
+    if (!bmp_coeff_ok && !load_coefficients()) { return SHRT_MAX; }
     ut = read_sensor(BMP180_TEMPERATURE, BMP180_ULTRA_HIGH);
     if (ut == LONG_MAX) { return SHRT_MAX; }
+    return (sint16)((true_b5(ut) + 8) / 16);
+}
 
-    // 2. Calculate true temperature:
-    x1 = (ut - coeff.ac6) * coeff.ac5 / 32768;
-    x2 = (sint32)coeff.mc * 2048 / (x1 + (sint32)coeff.md);
-    b5 = x1 + x2;
-    tt = (b5 + 8) / 16; // Temperature in 0.1C
 
-    // 3. TT, even though 32 bit, should not be outside range of signed 16 bit:
-    if (tt >= 0) {
-        ret = (sint16)(0x0000ffff & tt);
-    }
-    else {  // Negative temp
-        tt *= -1;
-        ret = (sint16)(0x0000ffff & tt);
-        ret *= -1;
-    }
-    return ret;
+/**
+ * @return The pressure in Pa (at the highest resolution), 0 on error
+ */
+uint24 read_bmp180_pressure(void)
+{
+    sint16 temp;
+    uint24 pressure;
+
+    if (!read_bmp180(BMP180_ULTRA_HIGH, 1, &temp, &pressure)) { return 0; }
+    return pressure;
 }
 
 
-uint24 read_bmp180_pressure(void)
+/**
+ * Intermediate B5 of the compensation (page 15 of the BMP180 datasheet), from which both the true
+ * temperature and the true pressure follow.
+ * @param ut Uncompensated temperature
+ */
+static sint32 true_b5(sint32 ut)
 {
-    bmp180_coeff coeff;
-    sint32 ut, tt, tp, up, x1, x2, x3, b3, b5, b6, temp;
-    uint32 b4, b7;
+    sint32 x1, x2;
+
+    x1 = (ut - bmp_coeff.ac6) * bmp_coeff.ac5 / 32768;
+    x2 = (sint32)bmp_coeff.mc * 2048 / (x1 + (sint32)bmp_coeff.md);
+    return x1 + x2;
+}
 
-    // 1. Retrieve coefficients and uncompensated temperature and pressure:
-    read_bmp180_coefficients(&coeff);
-    ut = read_sensor(BMP180_TEMPERATURE, BMP180_ULTRA_HIGH);
-    up = read_sensor(BMP180_PRESSURE,    BMP180_ULTRA_HIGH);
 
-    // 2. Calculate true temperature:
-    x1 = (ut - coeff.ac6) * coeff.ac5 / 32768;
-    x2 = (sint32)coeff.mc * 2048 / (x1 + (sint32)coeff.md);
-    b5 = x1 + x2;
-    tt = (b5 + 8) / 16; // Temperature in 0.1C
+/**
+ * True pressure (page 15 of the BMP180 datasheet).
+ * @param up Uncompensated pressure
+ * @param b5 B5 of the temperature conversion (see true_b5())
+ * @param oss Oversampling setting of the pressure conversion
+ * @return The pressure in Pa
+ */
+static uint24 true_pressure(sint32 up, sint32 b5, ubyte oss)
+{
+    sint32 tp, x1, x2, x3, b3, b6, temp;
+    uint32 b4, b7;
 
-    // 5. Calculate true pressure (page 13, BMP180 datasheet):
     b6 = b5 - 4000;
 
-    x1 = ((sint32)coeff.b2 * ((b6 * b6) / 4096)) / 2048;
-    x2 = ((sint32)coeff.ac2 * b6) / 2048;
+    x1 = ((sint32)bmp_coeff.b2 * ((b6 * b6) / 4096)) / 2048;
+    x2 = ((sint32)bmp_coeff.ac2 * b6) / 2048;
     x3 = x1 + x2;
-    temp = (sint32)coeff.ac1 * 4;
+    temp = (sint32)bmp_coeff.ac1 * 4;
     temp += x3;
-    temp = temp << BMP180_ULTRA_HIGH;
+    temp = temp << oss;
     temp += 2;
     b3 = temp / 4;
 
-    x1 = ((sint32)coeff.ac3 * b6) / 8192;
-    x2 = ((sint32)coeff.b1 * ((b6 * b6) / 4096)) / 65536;
+    x1 = ((sint32)bmp_coeff.ac3 * b6) / 8192;
+    x2 = ((sint32)bmp_coeff.b1 * ((b6 * b6) / 4096)) / 65536;
     x3 = ((x1 + x2) + 2) / 4;
-    b4 = (coeff.ac4 * (uint32)(x3 + 32768)) / 32768;
-    b7 = (uint32)(up - b3) * (50000 >> BMP180_ULTRA_HIGH);
+    b4 = (bmp_coeff.ac4 * (uint32)(x3 + 32768)) / 32768;
+    b7 = (uint32)(up - b3) * (50000 >> oss);
 
-    tp = (b7 < 0x80000000) ? tp = (b7 * 2) / b4 : (b7 / b4) * 2;
+    tp = (b7 < 0x80000000) ? (b7 * 2) / b4 : (b7 / b4) * 2;
     x1 = (tp / 256) * (tp / 256);
     temp = x1 * 3038;
     x1 = temp / 65536;
@@ -30,6 +30,7 @@ typedef struct {
 } bmp180_coeff;
 
 ubyte   init_bmp180_pressure(void);
+ubyte   read_bmp180(ubyte oss, ubyte samples, sint16 *temp, uint24 *pressure);
 uint24  read_bmp180_pressure(void);             // Return pressure in Pa
 sint16  read_bmp180_temperature(void);
 ubyte   read_bmp180_coefficients(bmp180_coeff *coeff);
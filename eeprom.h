@@ -0,0 +1,40 @@
+/*
+ * File:   eeprom.h
+ * Author: Maurits
+ *
+ * Created on 17 october 2026
+ *
+ * Storage backend: byte access to the 128 KB memory array of the 24LC1026. The firmware uses the
+ * EEPROM on the I2C bus (i2c.c). Host builds link the memory mapped image file of
+ * tools/eeprom_image.c instead, so the storage code can be run and benchmarked on a workstation.
+ */
+
+#ifndef EEPROM_H
+#define	EEPROM_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include "defs.h"
+#include "i2c.h"
+
+#define EEPROM_PAGE_SIZE    I2C_24LC1026_PAGE_SIZE
+#define EEPROM_SIZE         I2C_24LC1026_SIZE
+
+// Write any number of bytes at a 17-bit address. Page writes may still be in their write cycle
+// when the call returns, the next access waits for them.
+// Read any number of bytes at a 17-bit address.
+#ifdef __XC8
+#define eeprom_write(addr, buf, len)    i2c_eeprom_write(addr, buf, len)
+#define eeprom_read(addr, buf, len)     i2c_eeprom_read(addr, buf, len)
+#else
+ubyte   eeprom_write(uint24 addr, const ubyte *buf, uint16 len);
+ubyte   eeprom_read(uint24 addr, ubyte *buf, uint16 len);
+#endif
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* EEPROM_H */
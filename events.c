@@ -0,0 +1,223 @@
+/*
+ * File:   events.c
+ * Author: Maurits
+ *
+ * Created on 17 october 2026
+ *
+ * Journal of flight events in a ring of 8-byte entries in the EEPROM. Logging an event only
+ * appends it to a buffer in RAM; the buffer is written with a single (page) write at the end of
+ * the cycle, or as soon as it is full.
+ */
+
+#include "events.h"
+#include "record.h"
+#include "storage.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+#define EVENT_ADDR(i) ((uint24)EVENT_FIRST_PAGE * EEPROM_PAGE_SIZE + (uint16)(i) * sizeof(event_entry))
+
+static ubyte read_entry(uint16 i, event_entry *e);
+static ubyte write_entries(uint16 i, ubyte n);
+static void  reset_buffer(void);
+
+// Events not written yet. The buffer is persistent, so events logged late in a cycle (or while
+// the EEPROM could not be written) survive the watchdog reset and are written in the next cycle.
+#define EVENT_MAGIC 0x5AA5
+static persistent struct {
+    uint16      magic;              // EVENT_MAGIC iff the fields below can be trusted
+    ubyte       count;              // Number of buffered events
+    ubyte       cycle_done;         // True iff the last cycle ended normally (see event_cycle_done())
+    ubyte       init_fail;          // Subsystem that failed before the ring was found (INIT_FAIL_*)
+    event_entry buf[EVENT_BATCH];   // Buffered events, without sequence numbers
+} ev;
+
+// Head of the ring, found by init_events():
+static ubyte ev_ready = FALSE;      // True iff the head is known
+static uint16 ev_next;              // Entry the next event goes to
+static uint16 ev_seq;               // Sequence number of the next event
+static ubyte ev_wrapped;            // True iff the ring has been filled once
+
+
+/**
+ * Find the head of the event ring and log the reset that started this cycle.
+ * The entries hold increasing sequence numbers, so the newest one is the last (counting from
+ * entry 0) whose sequence number continues that of entry 0, as in the configuration journal.
+ * @param cold True after a power-on reset
+ * @param wdt True iff the watchdog timer reset the controller
+ * @return True iff the EEPROM could be read
+ */
+ubyte init_events(ubyte cold, ubyte wdt)
+{
+    event_entry e;
+    uint16 lo, hi, mid, seq0;
+
+    if (cold || ev.magic != EVENT_MAGIC || ev.count > EVENT_BATCH) {
+        reset_buffer();
+        ev.cycle_done = TRUE;
+    }
+
+    if (!eeprom_read(EVENT_ADDR(0), (ubyte *)&e, sizeof(event_entry))) { return FALSE; }
+    if (e.id >= EVENT_IDS) {
+        // Empty ring:
+        ev_next = 0;
+        ev_seq = 0;
+        ev_wrapped = FALSE;
+    }
+    else {
+        seq0 = e.seq;
+        lo = 0;
+        hi = EVENT_ENTRIES - 1;
+        while (lo < hi) {   // Invariant: entry lo continues the sequence of entry 0
+            mid = (lo + hi + 1) / 2;
+            if (read_entry(mid, &e) && e.seq == (uint16)(seq0 + mid)) { lo = mid; }
+            else { hi = mid - 1; }
+        }
+        ev_next = (lo + 1) % EVENT_ENTRIES;
+        ev_seq = seq0 + lo + 1;
+        ev_wrapped = (ev_next == 0 || read_entry(ev_next, &e));
+    }
+    ev_ready = TRUE;
+
+    // Each cycle ends with a watchdog reset, only a reset before the end of the cycle is an event:
+    if (cold) { event_log(EVENT_POWER_ON, 0); }
+    else if (wdt && !ev.cycle_done) { event_log(EVENT_WATCHDOG, global_config.ru.config.mode); }
+    if (ev.init_fail != INIT_FAIL_NONE) {
+        event_log(EVENT_INIT_FAIL, ev.init_fail);
+        ev.init_fail = INIT_FAIL_NONE;
+    }
+    ev.cycle_done = FALSE;
+    return TRUE;
+}
+
+
+/**
+ * Log an event. It is time stamped with the last record and the ms tick, and buffered until the
+ * end of the cycle, unless the buffer is full.
+ * @param id Event id (EVENT_*)
+ * @param payload Event specific payload byte
+ */
+void event_log(ubyte id, ubyte payload)
+{
+    event_entry *e;
+
+    if (ev.magic != EVENT_MAGIC || ev.count > EVENT_BATCH) { reset_buffer(); }
+    if (ev.count == EVENT_BATCH && !flush_events()) { return; }    // Keep the oldest events
+
+    e = &ev.buf[ev.count++];
+    e->record = global_config.ru.config.last_record;
+    e->ms = ms_ticks();
+    e->id = id;
+    e->payload = payload;
+    if (ev.count == EVENT_BATCH) { flush_events(); }
+}
+
+
+/**
+ * Log the failure of a subsystem in init(). A failure of the storage or of init_events() itself
+ * leaves the ring unusable, so it is kept in persistent RAM and logged by init_events() in the
+ * next cycle that gets that far. Repeated failures overwrite it rather than filling the buffer.
+ * @param what The subsystem that failed (INIT_FAIL_*)
+ */
+void event_init_failed(ubyte what)
+{
+    if (!ev_ready) {
+        if (ev.magic != EVENT_MAGIC || ev.count > EVENT_BATCH) { reset_buffer(); }
+        ev.init_fail = what;
+        return;
+    }
+    event_log(EVENT_INIT_FAIL, what);
+    flush_events();
+}
+
+
+/**
+ * Write the buffered events to the ring. The entries are consecutive, so this takes a single
+ * page write (two if they straddle a page boundary or the end of the ring).
+ * @return True iff the buffer is empty afterwards
+ */
+ubyte flush_events(void)
+{
+    ubyte i, n;
+
+    if (ev.count == 0) { return TRUE; }
+    if (!ev_ready) { return FALSE; }
+
+    for (i = 0; i < ev.count; i++) { ev.buf[i].seq = ev_seq + i; }
+    n = (ev.count < EVENT_ENTRIES - ev_next) ? ev.count : (ubyte)(EVENT_ENTRIES - ev_next);
+    if (!write_entries(0, n)) { return FALSE; }
+    if (n < ev.count && !write_entries(n, ev.count - n)) { return FALSE; }
+
+    ev_seq += ev.count;
+    ev_next = (ev_next + ev.count) % EVENT_ENTRIES;
+    if (ev_next < ev.count) { ev_wrapped = TRUE; }
+    ev.count = 0;
+    return TRUE;
+}
+
+
+/**
+ * Mark the end of a cycle: write the buffered events before the watchdog resets the controller,
+ * and tell the next cycle that this reset was expected.
+ */
+void event_cycle_done(void)
+{
+    flush_events();
+    ev.cycle_done = TRUE;
+}
+
+
+/**
+ * @return Number of events in the ring
+ */
+uint16 events_stored(void)
+{
+    return ev_wrapped ? EVENT_ENTRIES : ev_next;
+}
+
+
+/**
+ * Read an event from the ring.
+ * @param n Event number, 0 for the oldest event in the ring (0 - events_stored() - 1)
+ * @param e Event to read into
+ * @return True iff the event could be read
+ */
+ubyte read_event(uint16 n, event_entry *e)
+{
+    if (!ev_ready || n >= events_stored()) { return FALSE; }
+    return read_entry(ev_wrapped ? (ev_next + n) % EVENT_ENTRIES : n, e);
+}
+
+
+/**
+ * Read an entry of the ring.
+ * @return True iff the entry could be read and holds an event
+ */
+static ubyte read_entry(uint16 i, event_entry *e)
+{
+    if (!eeprom_read(EVENT_ADDR(i), (ubyte *)e, sizeof(event_entry))) { return FALSE; }
+    return (e->id < EVENT_IDS);
+}
+
+
+/**
+ * Write buffered events to consecutive entries of the ring, starting at the head.
+ * @param i First buffered event to write
+ * @param n Number of events to write
+ * @return True iff the events were written
+ */
+static ubyte write_entries(uint16 i, ubyte n)
+{
+    return eeprom_write(EVENT_ADDR((ev_next + i) % EVENT_ENTRIES), (ubyte *)&ev.buf[i], n * sizeof(event_entry));
+}
+
+
+static void reset_buffer(void)
+{
+    ev.magic = EVENT_MAGIC;
+    ev.count = 0;
+    ev.init_fail = INIT_FAIL_NONE;
+}
@@ -0,0 +1,75 @@
+/*
+ * File:   events.h
+ * Author: Maurits
+ *
+ * Created on 17 october 2026
+ *
+ * Journal of flight events (mode changes, parachute, GSM power, init failures, watchdog resets)
+ * in a ring of small fixed-size entries in the EEPROM, separate from the telemetry log.
+ */
+
+#ifndef EVENTS_H
+#define	EVENTS_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include "defs.h"
+#include "eeprom.h"
+
+// An event, as stored in the EEPROM. The record number and the ms tick together make the time
+// stamp: the tick restarts with every cycle (watchdog reset), the record number ties the cycle to
+// the GPS time of that record in the log.
+typedef struct {
+    uint16      seq;                // Sequence number, incremented for each event written
+    uint16      record;             // Number of the last record saved when the event happened
+    uint16      ms;                 // ms tick since the start of the cycle
+    ubyte       id;                 // EVENT_*, EVENT_NONE in an entry that was never written
+    ubyte       payload;            // Event specific, see below
+} event_entry;
+
+// Event ids and their payload:
+#define EVENT_POWER_ON      0       // Power-on reset, payload 0
+#define EVENT_WATCHDOG      1       // Watchdog reset before the end of a cycle, payload: the mode
+#define EVENT_INIT_FAIL     2       // init() failed, payload: INIT_FAIL_*
+#define EVENT_MODE          3       // Mode change, payload: the new mode
+#define EVENT_PARACHUTE     4       // Parachute fired, payload 0
+#define EVENT_GSM           5       // GSM power, payload: 1 on, 0 off
+#define EVENT_GPS_MISS      6       // GPS missed its deadline, payload: age of the last valid fix (acquisitions)
+#define EVENT_GPS_WAKE      7       // First acquisition after a wake, payload: time to fix (s), 255 if none before the deadline
+#define EVENT_IDS           8
+#define EVENT_NONE          0xFF
+
+#define EVENT_NAMES         { "power on", "watchdog", "init fail", "mode", "parachute", "gsm", "gps miss", "gps wake" }
+
+// Payload of EVENT_INIT_FAIL: the subsystem that failed
+#define INIT_FAIL_STORAGE   0
+#define INIT_FAIL_GSM       1
+#define INIT_FAIL_RADIO     2
+#define INIT_FAIL_BMP180    3
+#define INIT_FAIL_TEMP      4
+#define INIT_FAIL_EVENTS    5
+#define INIT_FAIL_NONE      0xFF
+
+// The event ring sits between the configuration journal and the log index (see storage.h).
+// Events are collected in RAM and written in one go, at most a page write per cycle.
+#define EVENT_PAGES         8
+#define EVENT_ENTRIES_PER_PAGE (EEPROM_PAGE_SIZE / sizeof(event_entry))
+#define EVENT_ENTRIES       (EVENT_PAGES * EVENT_ENTRIES_PER_PAGE)
+#define EVENT_BATCH         8       // Events buffered at most, a full buffer is written at once
+
+// Prototypes
+ubyte init_events(ubyte cold, ubyte wdt);
+void  event_log(ubyte id, ubyte payload);
+void  event_init_failed(ubyte what);
+ubyte flush_events(void);
+void  event_cycle_done(void);
+uint16 events_stored(void);
+ubyte read_event(uint16 n, event_entry *e);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* EVENTS_H */
@@ -10,11 +10,13 @@
 
 #include "flight.h"
 #include "record.h"
+#include "geo.h"
 #include "gps.h"
 #include "gsm.h"
 #include "parachute.h"
 #include "serial.h"
 #include "storage.h"
+#include "events.h"
 #include "radio.h"
 #include "temperature.h"
 #include "digital_pressure.h"
@@ -38,15 +40,48 @@ static void handle_state_desc_gsm(record *);
 static void handle_state_landed(record *);
 
 // General prototypes
-static void orientate(record *, record *);
+static void orientate(record *);
 static void sensor_measurements(record *);
-static void position_measurements(record *, record *);
-static ubyte mov_compare_pos(record *, record *);
-static void time_measurements(record *, gps_pos *, record *);
-static void prep_prev_record(record *);
-static void prep_curr_record(record *, record *);
+static void position_measurements(record *, gps_fix *);
+static ubyte is_moving(record *, gps_fix *);
+static void time_measurements(record *, gps_fix *);
+static void prep_curr_record(record *);
 static void save_curr_record_config(record *);
 static void set_mode(ubyte);
+static void hist_sync(void);
+static void hist_push(record *, uint16);
+static sint24 hist_alt(ubyte);
+
+// Altitude history: GPS altitude and time of the last RECS_HIST records, oldest first, and the
+// position of the newest one, updated once per cycle so the state machine needs no EEPROM reads to
+// look back. It is persistent, so it survives the watchdog reset that ends every cycle; after a
+// power-on reset it is rebuilt from the log once (without the date, which the log does not hold).
+#define RECS_HIST 10
+#define HIST_MAGIC 0xA55A
+static persistent struct {
+    uint16      magic;              // HIST_MAGIC iff the fields below can be trusted
+    uint16      last;               // Number of the newest record in the history
+    ubyte       next;               // Entry the next record goes to (the oldest entry)
+    ubyte       count;              // Number of valid entries (0 - RECS_HIST)
+    sint24      alt[RECS_HIST];     // GPS altitude (m)
+    uint24      time[RECS_HIST];    // Seconds since 00:00 UTC on the launch day
+    uint16      date;               // GPS day number (gps_day_number()) of the newest record, 0 if unknown
+    ubyte       has_pos;            // True iff the newest record has a GPS lock, so the position below is valid
+    sint32      lat;                // Position of the newest record in micro-degrees
+    sint32      lon;
+} hist;
+
+// A record counts as moving if the GPS speed, the altitude change or the distance since the last
+// record is large enough; all are noisy on the ground.
+#define MOVING_SPEED 100            // cm/s
+#define MOVING_ALT 20               // m
+#define MOVING_DIST 50              // m
+
+// Pressure conversions averaged per record (26 ms each at the highest resolution):
+#define PRESSURE_SAMPLES 4
+
+// GPS day number of the current record, for the history:
+static uint16 curr_date;
 
 
 /**
@@ -54,13 +89,12 @@ static void set_mode(ubyte);
  */
 void flight_control(void)
 {
-    record curr_rec, prev_rec;
+    record curr_rec;
     memset(&curr_rec, '\0', sizeof(record));
-    memset(&prev_rec, '\0', sizeof(record));
 
-    // Prepare the previous and current records:
-    prep_prev_record(&prev_rec);
-    prep_curr_record(&curr_rec, &prev_rec);
+    // Prepare the current record, the history holds what is needed of the previous ones:
+    hist_sync();
+    prep_curr_record(&curr_rec);
 
     // Determine state and action: based on previous state:
     switch (global_config.ru.config.mode) {
@@ -88,13 +122,14 @@ void flight_control(void)
     // Save and send current record as the last record and update the global config
     save_curr_record_config(&curr_rec);
     send_record(&curr_rec);
+
+    // Let the GPS sleep if the (new) mode allows:
+    gps_power(global_config.ru.config.mode);
 }
 
 
 static void set_mode(ubyte m) {
-#ifdef DEBUG_ON
-    printf("Switch to mode %u\r\n", m);
-#endif
+    event_log(EVENT_MODE, m);
     global_config.ru.config.mode = m;
 }
 
@@ -150,49 +185,42 @@ static void handle_state_asc_main(record *curr_rec)
 }
 
 
-#define RECS_HIST 10
 static void handle_state_asc_main2(record *curr_rec)
 {
-    // WARN: 32 + 11 * 3 + 2 + 1 + 2 = 70 bytes of stack memory (or even 80 in debug)
-    record rec;
-    sint24 alts[RECS_HIST + 1];
+    sint24 prev, alt;
     sint16 h_diff;
     ubyte i;
-    uint16 lr = global_config.ru.config.last_record;
 #ifdef DEBUG_ON
     sint32 pf24bfix;
     
     printf("MODE_ASC_MAIN2 ");
 #endif
     
-    // If less than 10 records are created, remain in ASC_MAIN2.
-    if (lr < RECS_HIST) {
+    // If less than 10 records are in the altitude history, remain in ASC_MAIN2.
+    hist_sync();
+    if (hist.count < RECS_HIST) {
 #ifdef DEBUG_ON
         printf("Remain - not enough records \r\n");
 #endif
         return;
     }
-    
-    // Read the previous RECS_HIST records, oldest first:
-    for (i = 0; i < RECS_HIST; i++) {
-        retr_record(lr - (RECS_HIST - 1) + i, &rec);
-        alts[i] = rec.ru.telemetry.alt_gps;
 #ifdef DEBUG_ON
-        pf24bfix = (sint32)alts[i];
+    for (i = 0; i < RECS_HIST; i++) {
+        pf24bfix = (sint32)hist_alt(i);
         printf("%ld ", pf24bfix);
-#endif
     }
-    alts[RECS_HIST] = curr_rec->ru.telemetry.alt_gps;
-#ifdef DEBUG_ON
-    pf24bfix = (sint32)alts[RECS_HIST];
+    pf24bfix = (sint32)curr_rec->ru.telemetry.alt_gps;
     printf("%ld\r\n", pf24bfix);
 #endif
     
-    // Read the last 5 records and see if they are monotonically descending, if so: DESC_BURST:
-    for (i = RECS_HIST - 5; i < RECS_HIST; i++) {
-        if (alts[i] <= alts[i + 1]) { break; }  // Only continue is next record is lower than the one before it
+    // Take the last 5 records and the current one and see if they are monotonically descending, if so: DESC_BURST:
+    prev = hist_alt(RECS_HIST - 5);
+    for (i = RECS_HIST - 4; i <= RECS_HIST; i++) {
+        alt = (i < RECS_HIST) ? hist_alt(i) : curr_rec->ru.telemetry.alt_gps;
+        if (prev <= alt) { break; }     // Only continue is next record is lower than the one before it
+        prev = alt;
     }
-    if (i == RECS_HIST) {   // Each record is lower than the one before it
+    if (i > RECS_HIST) {    // Each record is lower than the one before it
         set_mode(MODE_DESC_BURST);
         return;
     }
@@ -259,7 +287,7 @@ static void handle_state_desc_gsm(record *curr_rec)
     
     if (!curr_rec->status.moving) {
         set_mode(MODE_LANDED);
-        save_record(0, &global_config); // Save the new mode in case SMS takes too long
+        save_config(); // Save the new mode in case SMS takes too long
     }
     
     // Transmit position over radio first (in GSM boot-up takes too long)
@@ -289,53 +317,85 @@ static void handle_state_landed(record *curr_rec) {
 }
 
 
-/**
- * Retrieve the previous record. If there is none, create a dummy record:
- * Altitude is set to the lowest possible value in that record, and movement is set to ascending.
- */
-static void prep_prev_record(record *prev_rec)
+static void prep_curr_record(record *curr_rec)
+{
+    // 1. Take measurements:
+    curr_rec->status.config = 0;
+    orientate(curr_rec);
+    print_record(curr_rec);
+}
+
+
+static void save_curr_record_config(record *curr_rec)
 {
-    // 0. Retrieve previous flight record:
-    if (global_config.ru.config.last_record == 0) {     // This is the first record: create dummy previous record
-        prev_rec->status.ascending = 0;                 // Assume probe has just been launched and is on the ground in prelaunch
-        prev_rec->status.moving = 0;                    // Assume not yet moving
-        prev_rec->status.config = 0;                    // Telemetry record
-        prev_rec->ru.telemetry.alt_gps = SHRTLONG_MIN;  // Lowest possible height: next record will always be higher
+    // Save current record as the last record and update the global config. The log is a ring that
+    // overwrites its oldest records, so only the sequence numbers can run out (after 25 days):
+    if (global_config.ru.config.last_record < MAX_RECORD) {
+        hist_sync();    // The history must end with the previous record to append this one
+        global_config.ru.config.last_record++;
 #ifdef DEBUG_ON
-        printf("No previous record found, created dummy one\r\n");
+        printf("Saving record: ID %u\r\n", global_config.ru.config.last_record);
 #endif
+        // Buffered until its page is full. If it could not be saved, the next record takes its number:
+        if (save_record(global_config.ru.config.last_record, curr_rec)) { hist_push(curr_rec, curr_date); }
+        else { global_config.ru.config.last_record--; }
     }
-    else {
-        retr_record(global_config.ru.config.last_record, prev_rec);
-#ifdef DEBUG_ON
-        printf("Previous record retrieved: ID %u\r\n", global_config.ru.config.last_record);
-#endif
-    }    
+    save_config();      // Append global config to the EEPROM config journal
 }
 
 
-static void prep_curr_record(record *curr_rec, record *prev_rec)
+/**
+ * Make sure the altitude history ends with the last record. If it does not (power-on reset or a
+ * new flight), rebuild it from the last RECS_HIST records of the log.
+ */
+static void hist_sync(void)
 {
-    // 1. Take measurements:
-    curr_rec->status.config = 0;
-    orientate(curr_rec, prev_rec);
-    print_record(curr_rec);
+    record rec;
+    uint16 num;
+
+    if (hist.magic == HIST_MAGIC && hist.last == global_config.ru.config.last_record) { return; }
+
+    hist.magic = HIST_MAGIC;
+    hist.next = 0;
+    hist.count = 0;
+    num = (global_config.ru.config.last_record > RECS_HIST) ? global_config.ru.config.last_record - RECS_HIST : 0;
+    hist.last = num;
+    while (num < global_config.ru.config.last_record) {
+        num++;
+        if (!retr_record(num, &rec)) { hist.count = 0; }    // Only consecutive records count
+        else { hist_push(&rec, 0); }
+        hist.last = num;
+    }
 }
 
 
-static void save_curr_record_config(record *curr_rec)
+/**
+ * Add the record following the newest one to the altitude history, dropping the oldest entry.
+ * @param rec The record
+ * @param date Its GPS day number, 0 if unknown
+ */
+static void hist_push(record *rec, uint16 date)
 {
-    // Save current record as the last record and update the global config
-    global_config.ru.config.last_record++;
-    if (global_config.ru.config.last_record >= RECORDS_PER_BLOCK * 2) {
-        // When we exceed the 4095 telemetry records, we keep rewriting the final (4095) record:
-        global_config.ru.config.last_record = RECORDS_PER_BLOCK * 2 - 1;
-    }
-#ifdef DEBUG_ON
-    printf("Saving record: ID %u\r\n", global_config.ru.config.last_record);
-#endif
-    save_record(global_config.ru.config.last_record, curr_rec);
-    save_record(0, &global_config);     // Save global config to EEPROM
+    hist.alt[hist.next] = rec->ru.telemetry.alt_gps;
+    hist.time[hist.next] = ((uint24)rec->ru.telemetry.days * 24 + rec->ru.telemetry.hours) * 3600 + \
+            (uint24)rec->ru.telemetry.minutes * 60 + rec->ru.telemetry.seconds;
+    hist.date = date;
+    hist.has_pos = rec->status.gps_lock;
+    hist.lat = rec->ru.telemetry.latitude;
+    hist.lon = rec->ru.telemetry.longitude;
+    hist.next = (hist.next + 1) % RECS_HIST;
+    if (hist.count < RECS_HIST) { hist.count++; }
+    hist.last++;
+}
+
+
+/**
+ * Altitude of an entry in the history.
+ * @param i Entry, counting from the oldest (0 ... hist.count - 1)
+ */
+static sint24 hist_alt(ubyte i)
+{
+    return hist.alt[(hist.next + RECS_HIST - hist.count + i) % RECS_HIST];
 }
 
 
@@ -343,16 +403,18 @@ static void save_curr_record_config(record *curr_rec)
  * Take measurements, get the GPS position and set several flags in the location
  * record.
  * @param curr_rec The current record to be populated
- * @param prev_rec Previous record
  */
-static void orientate(record *curr_rec, record *prev_rec)
+static void orientate(record *curr_rec)
 {
+    gps_fix fix;
+
     // 1. Get sensor data, and GPS time and position:
     sensor_measurements(curr_rec);
-    position_measurements(curr_rec, prev_rec);
+    position_measurements(curr_rec, &fix);
     
-    curr_rec->status.ascending = (curr_rec->ru.telemetry.alt_gps > prev_rec->ru.telemetry.alt_gps) ? 1: 0;
-    curr_rec->status.moving = mov_compare_pos(curr_rec, prev_rec);
+    // Without a previous record, the first one counts as ascending:
+    curr_rec->status.ascending = (hist.count == 0 || curr_rec->ru.telemetry.alt_gps > hist_alt(hist.count - 1)) ? 1: 0;
+    curr_rec->status.moving = is_moving(curr_rec, &fix);
     
     // TODO 2. Set the necessary status flags:
     if (sms_ready()) { curr_rec->status.gsm_on = 1; }
@@ -363,40 +425,30 @@ static void orientate(record *curr_rec, record *prev_rec)
 
 
 /**
- * Compare longitude, latitude and altitude: if all equal, return 0, otherwise 1 for moving.
+ * Determine whether the probe is moving, from the GPS speed over ground, and the altitude change
+ * and the distance since the last record.
  * @param curr_rec
- * @param prev_rec
- * @return 0 iff long, lat and alt are all equal (and there is a GPS lock).
+ * @param fix The GPS fix of the record
+ * @return 1 if moving, 0 if not (or if there is no GPS lock)
  */
-static ubyte mov_compare_pos(record *curr_rec, record *prev_rec)
+static ubyte is_moving(record *curr_rec, gps_fix *fix)
 {
-    ubyte i;
-    
-    // If there was or is no GPS lock, return 0 (no move) as nothing real movement can be determined:
-    if (!curr_rec->status.gps_lock || !prev_rec->status.gps_lock) {
+    sint24 climb;
+
+    // If there is no GPS lock, return 0 (no move) as nothing real movement can be determined:
+    if (!curr_rec->status.gps_lock) {
         return 0;
     }
-    
-    // Determine if longitude is equal:
-    for (i = 0; i < 9; i++) {   // 9 chars for longitude
-        if (curr_rec->ru.telemetry.longitude[i] != prev_rec->ru.telemetry.longitude[i]) {
-            return 1;   // Longitude not equal: immediately return
-        }
-    }
-    
-    // Determine if latitude is equal:
-    for (i = 0; i < 8; i++) {   // 8 chars for latitude
-        if (curr_rec->ru.telemetry.latitude[i] != prev_rec->ru.telemetry.latitude[i]) {
-            return 1;   // Latitude not equal: immediately return
-        }
+    if (fix->speed >= MOVING_SPEED) {
+        return 1;
     }
-    
-    // Determine if altitude is equal:
-    if (curr_rec->ru.telemetry.alt_gps != prev_rec->ru.telemetry.alt_gps) {
-        return 1;       // Not equal: immediately return
+    if (hist.count > 0) {
+        climb = curr_rec->ru.telemetry.alt_gps - hist_alt(hist.count - 1);
+        if (climb >= MOVING_ALT || climb <= -MOVING_ALT) { return 1; }
+        if (hist.has_pos && geo_distance(hist.lat, hist.lon, curr_rec->ru.telemetry.latitude, \
+                curr_rec->ru.telemetry.longitude) >= MOVING_DIST) { return 1; }
     }
-    
-    return 0;   // Everything equal, so return 0 (no move)
+    return 0;
 }
 
 
@@ -407,17 +459,21 @@ static ubyte mov_compare_pos(record *curr_rec, record *prev_rec)
 static void sensor_measurements(record *curr_rec)
 {
     sint16 temp_in, temp_ex;
-    uint24 temp = 0;
+    uint24 temp = 0, pressure;
+
+    // 1. Get the internal temperature and the pressure from the BMP180 in one go:
+    if (!read_bmp180(BMP180_ULTRA_HIGH, PRESSURE_SAMPLES, &temp_in, &pressure)) {
+        temp_in = SHRT_MAX;     // As get_internal_temp() on error
+        pressure = 0;
+    }
 
-    // 1. Get temperature:
-    temp_in = get_internal_temp();
+    // 2. Get the external temperature:
     temp_ex = get_external_temp();
     temp = ((uint24)temp_ex << 12) | ((uint24)temp_in & 0x000fff);  // Shift together into 24 bits
     curr_rec->ru.telemetry.temperature = temp;
 
-    // 2. Get BMP180 pressure:
     curr_rec->ru.telemetry.status2.baro_digi = 1;
-    curr_rec->ru.telemetry.pressure = read_bmp180_pressure();
+    curr_rec->ru.telemetry.pressure = pressure;
 }
 
 
@@ -425,87 +481,72 @@ static void sensor_measurements(record *curr_rec)
  * Add position (GPS) information to the given curr_rec.
  * @param curr_rec Current telemetry record which is being updated
  */
-static void position_measurements(record *curr_rec, record *prev_rec)
+static void position_measurements(record *curr_rec, gps_fix *fix)
 {
-    gps_pos pos;
-    ubyte i;
-    sint32 tmp_alt;
-
-    // 1. Retrieve GPS information:
-    get_position(&pos);
-
-    // 2. Set hemisphere (N vs S and E vs W) information:
-    curr_rec->ru.telemetry.status2.north_hemi = (pos.lat_hemi[0] == 'N') ? 1: 0;
-    curr_rec->ru.telemetry.status2.east_hemi = (pos.lon_hemi[0] == 'E') ? 1: 0;
-
-    // 3. Check for GPS fix:
-    if (pos.pos_fix[0] == '1') {
-        curr_rec->status.gps_lock = 1;
-        curr_rec->status.error = 0;
-    }
-    else {  // No lock: set error flag:
+    // 1. Retrieve GPS information, or the last valid fix if the GPS sleeps or stays silent:
+    if (gps_skip()) {
+        gps_last_fix(fix);
+        curr_rec->ru.telemetry.status2.gps_stale = 1;
         curr_rec->status.gps_lock = 0;
-        curr_rec->status.error = 1;
-    }
-
-    // 3. Set time:
-    time_measurements(curr_rec, &pos, prev_rec);
-    
-    // 4. Set altitude (complex logic to avoid 32 to 24 bit truncation and changes in sign):
-    tmp_alt = atol(pos.altitude);
-    if (tmp_alt > SHRTLONG_MAX) {
-        curr_rec->ru.telemetry.alt_gps = SHRTLONG_MAX;  // 8389 km which is unlikely
-    }
-    else if (tmp_alt < SHRTLONG_MIN) {
-        curr_rec->ru.telemetry.alt_gps = SHRTLONG_MAX;  // -8389 km which is equally unlikely
+        curr_rec->status.error = 0;         // Sleeping is no error
     }
     else {
-        curr_rec->ru.telemetry.alt_gps = (sint24)tmp_alt;   // Should be safe
-    }
+        if (get_position(fix, GPS_DEADLINE_MS)) {
+            curr_rec->ru.telemetry.status2.gps_stale = 0;
+        }
+        else {
+            curr_rec->ru.telemetry.status2.gps_stale = 1;
+            fix->quality = 0;       // Not a lock, but the last known position is better than none
+            event_log(EVENT_GPS_MISS, fix->age);
+        }
 
-    // 5. Set latitude and longitude:
-    curr_rec->ru.telemetry.longitude[0] = pos.longitude[0];             // The 100 degree byte of longitude
-    for (i = 0; i < 4; i++) {                                           // Lat / lon information up to the dot (ddmm.):
-        curr_rec->ru.telemetry.latitude[i] = pos.latitude[i];
-        curr_rec->ru.telemetry.longitude[i + 1] = pos.longitude[i + 1]; // The first decimal is already handled
-    }
-    for (i = 4; i < 8; i++) {                                           // Lat / lon information after the dot (.mmmm):
-        curr_rec->ru.telemetry.latitude[i] = pos.latitude[i + 1];
-        curr_rec->ru.telemetry.longitude[i + 1] = pos.longitude[i + 2]; // The first decimal is already handled
+        // 2. Check for GPS fix:
+        if (fix->quality != 0) {
+            curr_rec->status.gps_lock = 1;
+            curr_rec->status.error = 0;
+        }
+        else {  // No lock: set error flag:
+            curr_rec->status.gps_lock = 0;
+            curr_rec->status.error = 1;
+        }
     }
+
+    // 3. Set time, altitude, latitude and longitude:
+    time_measurements(curr_rec, fix);
+    curr_rec->ru.telemetry.alt_gps = fix->altitude;
+    curr_rec->ru.telemetry.latitude = fix->latitude;
+    curr_rec->ru.telemetry.longitude = fix->longitude;
 }
 
 
 /**
- * Parse NMEA GPGGA time information (hhmmss) into record.
+ * Set the GPS time (UTC) of the record, and the days since launch: from the GPS date if both it and
+ * that of the last record are known, otherwise from the time of day wrapping around since then.
  * @param curr_rec
- * @param pos
+ * @param fix
  */
-static void time_measurements(record *curr_rec, gps_pos *pos, record *prev_rec)
+static void time_measurements(record *curr_rec, gps_fix *fix)
 {
-    ubyte buf[3];
-    
-    buf[0] = pos->time[0];
-    buf[1] = pos->time[1];
-    buf[2] = '\0';
-    curr_rec->ru.telemetry.hours = (ubyte)atoi(buf);
-            
-    buf[0] = pos->time[2];
-    buf[1] = pos->time[3];
-    buf[2] = '\0';
-    curr_rec->ru.telemetry.minutes = (ubyte)atoi(buf);
- 
-    buf[0] = pos->time[4];
-    buf[1] = pos->time[5];
-    buf[2] = '\0';
-    curr_rec->ru.telemetry.seconds = (ubyte)atoi(buf);
-    
-    // In order to determine the days, have a look at the previous record:
-    if (curr_rec->ru.telemetry.hours < prev_rec->ru.telemetry.hours) {
-        // Increment the number of days:
-        curr_rec->ru.telemetry.days = prev_rec->ru.telemetry.days + 1;
+    uint24 last, now;
+    uint16 days;
+
+    curr_rec->ru.telemetry.hours = fix->hours;
+    curr_rec->ru.telemetry.minutes = fix->minutes;
+    curr_rec->ru.telemetry.seconds = fix->seconds;
+    curr_date = gps_day_number(fix);
+
+    if (hist.count == 0) {      // First record of the flight
+        curr_rec->ru.telemetry.days = 0;
+        return;
     }
-    else {  // Keep the same number of days as the previous record:
-        curr_rec->ru.telemetry.days = prev_rec->ru.telemetry.days;
+    last = hist.time[(hist.next + RECS_HIST - 1) % RECS_HIST];
+    days = (uint16)(last / 86400);
+    if (curr_date != 0 && hist.date != 0 && curr_date >= hist.date) {
+        days += curr_date - hist.date;
+    }
+    else {
+        now = ((uint24)fix->hours * 60 + fix->minutes) * 60 + fix->seconds;
+        if (now < last % 86400) { days++; }
     }
+    curr_rec->ru.telemetry.days = (days > UCHAR_MAX) ? UCHAR_MAX : (ubyte)days;
 }
@@ -0,0 +1,200 @@
+/*
+ * File:   geo.c
+ * Author: Maurits
+ *
+ * Created on 17 october 2026
+ *
+ * Fixed-point geodesy on micro-degree coordinates. Distances use the equirectangular
+ * approximation: a degree of longitude is shortened by the cosine of the mean latitude, taken
+ * from a table, after which the earth is flat. That is accurate to well within GPS noise up to a
+ * few hundred kilometers, which is all a balloon flight needs.
+ */
+
+#include "geo.h"
+
+#include <limits.h>
+
+
+#define COS_STEP    5000000L        // Micro-degrees between the entries of cos_lut
+
+// cos(5 * i degrees) times 65535, i = 0 - 18:
+static const uint16 cos_lut[19] = {
+    65535, 65286, 64539, 63302, 61583, 59395, 56755, 53683, 50203, 46340,
+    42125, 37589, 32768, 27696, 22414, 16962, 11380, 5712, 0
+};
+
+// atan(i / 16) in 0.1 degrees, i = 0 - 16:
+static const uint16 atan_lut[17] = {
+    0, 36, 71, 106, 140, 174, 206, 236, 266, 294, 320, 345, 369, 391, 412, 432, 450
+};
+
+static void   geo_delta(sint32 lat1, sint32 lon1, sint32 lat2, sint32 lon2, sint32 *dx, sint32 *dy);
+static uint16 geo_cos(sint32 lat);
+static uint32 mul_q16(uint32 v, uint16 f);
+static uint16 isqrt(uint32 v);
+
+
+/**
+ * Distance between two positions.
+ * @param lat1 Latitude of the first position in micro-degrees, north positive
+ * @param lon1 Longitude of the first position in micro-degrees, east positive
+ * @param lat2 Latitude of the second position
+ * @param lon2 Longitude of the second position
+ * @return The distance in meters
+ */
+uint32 geo_distance(sint32 lat1, sint32 lon1, sint32 lat2, sint32 lon2)
+{
+    sint32 dx, dy;
+    uint32 a, b;
+    ubyte shift = 0;
+
+    geo_delta(lat1, lon1, lat2, lon2, &dx, &dy);
+    a = mul_q16((dx < 0) ? (uint32)-dx : (uint32)dx, GEO_M_PER_UDEG_Q16);
+    b = mul_q16((dy < 0) ? (uint32)-dy : (uint32)dy, GEO_M_PER_UDEG_Q16);
+
+    // Scale down until the sum of squares fits 32 bits:
+    while (a > 46340 || b > 46340) {
+        a >>= 1;
+        b >>= 1;
+        shift++;
+    }
+    return (uint32)isqrt(a * a + b * b) << shift;
+}
+
+
+/**
+ * Bearing from one position to another.
+ * @param lat1 Latitude of the first position in micro-degrees, north positive
+ * @param lon1 Longitude of the first position in micro-degrees, east positive
+ * @param lat2 Latitude of the second position
+ * @param lon2 Longitude of the second position
+ * @return The bearing in 0.1 degrees from true north (0 - 3599), 0 if the positions are equal
+ */
+uint16 geo_bearing(sint32 lat1, sint32 lon1, sint32 lat2, sint32 lon2)
+{
+    sint32 dx, dy;
+    uint32 x, y, lo, hi;
+    uint16 r, a;
+    ubyte i;
+
+    geo_delta(lat1, lon1, lat2, lon2, &dx, &dy);
+    x = (dx < 0) ? (uint32)-dx : (uint32)dx;
+    y = (dy < 0) ? (uint32)-dy : (uint32)dy;
+    if (x == 0 && y == 0) { return 0; }
+
+    // Angle of the octant from the ratio of the smaller and the larger component:
+    lo = (x < y) ? x : y;
+    hi = (x < y) ? y : x;
+    while (hi > USHRT_MAX) {
+        lo >>= 1;
+        hi >>= 1;
+    }
+    r = (uint16)((lo << 12) / hi);          // 0 - 4096
+    i = (ubyte)(r >> 8);
+    a = atan_lut[i];
+    if (i < 16) { a += (uint16)(((uint32)(atan_lut[i + 1] - atan_lut[i]) * (r & 0xFF)) >> 8); }
+    if (x > y) { a = 900 - a; }             // Angle from north, toward east
+
+    if (dy >= 0) { return (dx >= 0) ? a : (a == 0 ? 0 : 3600 - a); }
+    return (dx >= 0) ? 1800 - a : 1800 + a;
+}
+
+
+/**
+ * Write a coordinate as degrees and minutes: ddmm.mmmm, or dddmm.mmmm for a longitude. The sign
+ * is left out, the caller adds it or the hemisphere.
+ * @param coord The coordinate in micro-degrees
+ * @param deg_digits Number of degree digits (2 or 3)
+ * @param sep Character between the degrees and the minutes, 0 for none
+ * @param buf Buffer of GEO_DDMM_SIZE characters for the zero terminated text
+ */
+void geo_ddmm(sint32 coord, ubyte deg_digits, ubyte sep, ubyte *buf)
+{
+    uint32 a = (coord < 0) ? (uint32)-coord : (uint32)coord;
+    uint32 min = ((a % GEO_UDEG_PER_DEG) * 6 + 5) / 10;     // 1e-4 minutes
+    uint16 v;
+    sbyte i;
+
+    if (min > 599999) { min = 599999; }
+    v = (uint16)(a / GEO_UDEG_PER_DEG);
+    for (i = deg_digits - 1; i >= 0; i--) {
+        buf[i] = '0' + v % 10;
+        v /= 10;
+    }
+    buf += deg_digits;
+    if (sep) { *buf++ = sep; }
+    v = (uint16)(min / 10000);
+    *buf++ = '0' + v / 10;
+    *buf++ = '0' + v % 10;
+    *buf++ = '.';
+    v = (uint16)(min % 10000);
+    for (i = 3; i >= 0; i--) {
+        buf[i] = '0' + v % 10;
+        v /= 10;
+    }
+    buf[4] = '\0';
+}
+
+
+/**
+ * East and north components of the displacement between two positions, in micro-degrees of
+ * latitude (so the longitude difference is shortened to the mean latitude).
+ */
+static void geo_delta(sint32 lat1, sint32 lon1, sint32 lat2, sint32 lon2, sint32 *dx, sint32 *dy)
+{
+    sint32 dlon = lon2 - lon1;
+    uint32 x;
+
+    // The short way around, across the date line if need be:
+    if (dlon > 180 * GEO_UDEG_PER_DEG) { dlon -= 360 * GEO_UDEG_PER_DEG; }
+    else if (dlon < -180 * GEO_UDEG_PER_DEG) { dlon += 360 * GEO_UDEG_PER_DEG; }
+
+    x = mul_q16((dlon < 0) ? (uint32)-dlon : (uint32)dlon, geo_cos(lat1 + (lat2 - lat1) / 2));
+    *dx = (dlon < 0) ? -(sint32)x : (sint32)x;
+    *dy = lat2 - lat1;
+}
+
+
+/**
+ * Cosine of a latitude, interpolated in cos_lut.
+ * @param lat The latitude in micro-degrees
+ * @return The cosine times 65535
+ */
+static uint16 geo_cos(sint32 lat)
+{
+    uint32 a = (lat < 0) ? (uint32)-lat : (uint32)lat;
+    ubyte i;
+
+    if (a >= 90 * GEO_UDEG_PER_DEG) { return 0; }
+    i = (ubyte)(a / COS_STEP);
+    return cos_lut[i] - (uint16)((uint32)(cos_lut[i] - cos_lut[i + 1]) * ((a % COS_STEP) / 5000) / 1000);
+}
+
+
+/**
+ * @return v * f / 65536, without overflowing 32 bits
+ */
+static uint32 mul_q16(uint32 v, uint16 f)
+{
+    return (v >> 16) * f + (((v & 0xFFFF) * f) >> 16);
+}
+
+
+/**
+ * @return The integer square root of v
+ */
+static uint16 isqrt(uint32 v)
+{
+    uint32 root = 0, bit = (uint32)1 << 30;
+
+    while (bit > v) { bit >>= 2; }
+    while (bit != 0) {
+        if (v >= root + bit) {
+            v -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else { root >>= 1; }
+        bit >>= 2;
+    }
+    return (uint16)root;
+}
@@ -0,0 +1,35 @@
+/*
+ * File:   geo.h
+ * Author: Maurits
+ *
+ * Created on 17 october 2026
+ *
+ * Fixed-point geodesy on micro-degree coordinates: distance and bearing without trigonometry,
+ * and the ddmm.mmmm text of the downlink formats.
+ */
+
+#ifndef GEO_H
+#define	GEO_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include "defs.h"
+
+#define GEO_UDEG_PER_DEG    1000000L
+#define GEO_M_PER_UDEG_Q16  7287        // 0.11119 m per micro-degree (mean earth radius 6371 km), times 65536
+
+// Size of the text written by geo_ddmm(): up to 3 degree digits, separator, mm.mmmm and a zero
+#define GEO_DDMM_SIZE       12
+
+uint32 geo_distance(sint32 lat1, sint32 lon1, sint32 lat2, sint32 lon2);
+uint16 geo_bearing(sint32 lat1, sint32 lon1, sint32 lat2, sint32 lon2);
+void   geo_ddmm(sint32 coord, ubyte deg_digits, ubyte sep, ubyte *buf);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* GEO_H */
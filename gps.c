@@ -3,158 +3,692 @@
  * Author: Maurits
  *
  * Created on 30 september 2012, 14:59
+ *
+ * GPS handling routines. NMEA sentences (of any GNSS talker) are parsed one character at a time as they are received:
+ * every field is converted to a number as its characters arrive and stored in the fix when its
+ * separator arrives, so the fix is complete when the checksum at the end of the sentence is.
  */
 
 #include "gps.h"
 
 #include "serial.h"
+#include "events.h"
+#include "ubx.h"
+#include "util.h"
 
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
+
+
+// States of the NMEA parser:
+#define NMEA_IDLE       0           // Waiting for the '$' that starts a sentence
+#define NMEA_ADDRESS    1           // Talker id and sentence formatter, up to the first ','
+#define NMEA_FIELDS     2           // Data fields, up to the '*'
+#define NMEA_CHECKSUM   3           // The two hex digits of the checksum
+
+#define NMEA_ADDRESS_SIZE   5       // Talker id (2) and sentence formatter (3)
+#define NMEA_MAX_DECIMALS   4       // Decimals kept of a field, the rest is ignored (32-bit values)
+#define NMEA_MAX_GGA_ONLY   3       // GGA sentences without an RMC after which the GGA alone will do
+
+// GGA fields, numbered from 1 after the address:
+#define GGA_TIME        1
+#define GGA_LAT         2
+#define GGA_LAT_HEMI    3
+#define GGA_LON         4
+#define GGA_LON_HEMI    5
+#define GGA_QUALITY     6
+#define GGA_SATELLITES  7
+#define GGA_HDOP        8
+#define GGA_ALTITUDE    9
+
+// RMC fields:
+#define RMC_TIME        1
+#define RMC_SPEED       7           // Knots
+#define RMC_COURSE      8
+#define RMC_DATE        9           // ddmmyy
+
+// VTG fields:
+#define VTG_COURSE      1           // True course
+#define VTG_SPEED       7           // km/h
 
+static void  nmea_start(void);
+static ubyte nmea_talker(void);
+static ubyte nmea_address(void);
+static void  nmea_field(void);
+static void  gga_field(void);
+static void  rmc_field(void);
+static void  vtg_field(void);
+static void  field_time(void);
+static void  nmea_merge(void);
+static uint32 field_value(ubyte decimals);
+static sint32 field_coord(void);
+static ubyte hex_value(ubyte c);
+static void  print_coord(sint32 coord, ubyte pos, ubyte neg);
+static ubyte gps_policy(ubyte mode);
+static void  gps_wake(void);
+static void  gps_woken(ubyte fixed, uint16 ttf);
 
-static void retr_gpgga_sentence(ubyte *buf, uint16 bufsize);
-static ubyte parse_gpgga(gps_pos *pos);
-static uint16 next_token(ubyte *, sint16, ubyte *, uint16);
+uint16 global_nmea_checksum_errors;
+uint16 global_nmea_rejects;
 
+uint16 global_gps_misses;
 
-ubyte global_gps_buf[NMEA_BUF_SIZE];
+// Protocol of the receiver, decided after a power-on reset, and the last valid fix. The struct is
+// persistent, so the receiver is only configured once, and the fix outlives the cycle:
+#define GPS_MAGIC 0x6A5A
+static persistent struct {
+    uint16      magic;              // GPS_MAGIC iff the fields below can be trusted
+    ubyte       ubx;                // True iff the receiver sends UBX NAV-PVT instead of NMEA
+    uint16      misses;             // Acquisitions that missed the deadline since the power-on reset
+    gps_fix     last;               // Last fix with quality != 0, all zero if none yet
+    ubyte       power;              // Power level set by gps_power() (GPS_POWER_*)
+    ubyte       asleep;             // True iff the receiver is in backup or standby
+    ubyte       cycles;             // Cycles slept since the last fix
+    ubyte       woken;              // True iff the receiver was woken and has no fix yet
+    uint16      ttf_last;           // Time to fix after the last wake (ms)
+    uint16      ttf_max;            // Longest time to fix after a wake (ms)
+    uint32      ttf_sum;            // Sum of the times to fix, for the mean
+    uint16      ttf_count;          // Wakes with a fix before the deadline
+    uint16      ttf_fails;          // Wakes without a fix before the deadline
+} gps;
 
+// Parser state:
+static struct {
+    ubyte       state;              // NMEA_*
+    ubyte       sentence;           // NMEA_GGA ... or NMEA_NONE if the sentence is skipped
+    ubyte       field;              // Number of the field being received, 0 for the address
+    ubyte       checksum;           // XOR of the characters between '$' and '*'
+    ubyte       received;           // Checksum received so far
+    ubyte       len;                // Characters of the field so far
+    ubyte       first;              // First character of the field
+    ubyte       dot;                // True iff the field has a decimal point
+    ubyte       negative;           // True iff the field started with a '-'
+    ubyte       decimals;           // Digits after the decimal point kept in value
+    uint32      value;              // Digits of the field without the decimal point
+    ubyte       address[NMEA_ADDRESS_SIZE];
+    gps_fix     fix;                // Fields of the sentence being received
+    gps_fix     epoch;              // The sentences received of the current epoch, merged
+} nmea;
 
-ubyte get_position(gps_pos *pos)
+
+/**
+ * Find out whether the GPS is a u-blox receiver, and if so configure it for flight and switch it
+ * to UBX. Other receivers are read with NMEA.
+ * @param cold True after a power-on reset
+ * @return True
+ */
+ubyte init_gps(ubyte cold)
 {
-    memset(global_gps_buf, '\0', sizeof(global_gps_buf));
+    if (!cold && gps.magic == GPS_MAGIC) {
+        global_gps_misses = gps.misses;
+        return TRUE;
+    }
 
-    // 1. Switch to GPS and retrieve a single GPGGA sentence:
+    memset(&gps, '\0', sizeof(gps));
     serial_channel(SELECT_GPS);
-    retr_gpgga_sentence(global_gps_buf, sizeof(global_gps_buf));
+    gps.ubx = ubx_configure();
     serial_channel(SELECT_PC);
+    gps.magic = GPS_MAGIC;
+    printf(gps.ubx ? "GPS UBX " : "GPS NMEA ");
+    return TRUE;
+}
 
-    // 2. Parse it:
-    //printf("buffer: %s\n", global_gps_buf);
-    return parse_gpgga(pos);
+
+/**
+ * Switch to the GPS and wait for the GGA and RMC sentences of an epoch (or a NAV-PVT message of a
+ * UBX receiver). A GPS that sends no RMC sentences is given a few epochs, after that the GGA
+ * sentence alone will do. A GPS that stays silent past the deadline gets the last valid fix
+ * instead, with its age, so the cycle can go on to log and send the record.
+ * @param fix The fix to fill in
+ * @param deadline_ms Milliseconds to wait for the GPS (at most 65535)
+ * @return True iff the fix is fresh, false if it is the last valid fix (or all zero if none)
+ */
+ubyte get_position(gps_fix *fix, uint16 deadline_ms)
+{
+    ubyte buf[16];
+    ubyte i, n, s, gga = 0, done = FALSE;
+    uint16 start;
+
+    if (gps.magic != GPS_MAGIC) {       // init_gps() did not run: NMEA, and no fix cached yet
+        memset(&gps, '\0', sizeof(gps));
+        gps.magic = GPS_MAGIC;
+    }
+    if (gps.asleep) { gps_wake(); }
+    start = ms_ticks();
+
+    memset(fix, '\0', sizeof(gps_fix));
+    memset(&nmea.epoch, '\0', sizeof(gps_fix));
+    nmea.state = NMEA_IDLE;
+
+    // Parse whatever the ring buffer holds, so bursts are drained while the next ones arrive:
+    serial_channel(SELECT_GPS);
+    while (!done && ms_since(start) < deadline_ms) {
+        if (!data_rdy_uart()) { continue; }     // Wait for characters to arrive
+        n = read_uart(buf, sizeof(buf));
+        for (i = 0; i < n && !done; i++) {
+            if (gps.ubx) {
+                done = (ubx_parse(buf[i], fix) == UBX_PVT);
+                continue;
+            }
+            s = gps_parse(buf[i], fix);
+            if (s != NMEA_NONE && nmea.sentence == NMEA_GGA) { gga++; }   // s holds the whole epoch
+            done = ((s & NMEA_EPOCH) == NMEA_EPOCH || ((s & NMEA_GGA) && gga >= NMEA_MAX_GGA_ONLY));
+        }
+    }
+    serial_channel(SELECT_PC);
+
+    if (done && fix->quality != 0) {
+        if (gps.woken) { gps_woken(TRUE, ms_since(start)); }
+        gps.last = *fix;
+        return TRUE;
+    }
+    if (gps.woken) { gps_woken(FALSE, 0); }
+    if (gps.last.age < UCHAR_MAX) { gps.last.age++; }
+    if (done) { return TRUE; }
+
+    // Missed the deadline. The receiver may have lost power and with it the UBX configuration (or
+    // a u-blox receiver came back that was taken for an NMEA one), so find out again what it talks:
+    global_gps_misses = ++gps.misses;
+    *fix = gps.last;
+    serial_channel(SELECT_GPS);
+    gps.ubx = ubx_configure();
+    serial_channel(SELECT_PC);
+    gps.power = GPS_POWER_UNKNOWN;
+#ifdef DEBUG_ON
+    printf("GPS missed the deadline, last fix %u acquisitions old\r\n", fix->age);
+#endif
+    return FALSE;
 }
 
 
 /**
- * Output GPS information in a human readable format.
- * @param pos
+ * The last valid fix, for a cycle in which the receiver sleeps (see gps_skip()).
+ * @param fix The fix to fill in, all zero if there is none
+ */
+void gps_last_fix(gps_fix *fix)
+{
+    if (gps.last.age < UCHAR_MAX) { gps.last.age++; }
+    *fix = gps.last;
+}
+
+
+/**
+ * Apply the power policy of a flight mode, at the end of a cycle: the receiver tracks
+ * continuously in flight, in power save mode while waiting for the launch, and once landed it
+ * only wakes every GPS_SLEEP_CYCLES cycles for a fix. The receiver goes back to sleep only after
+ * it has a fix. Power save mode is a UBX feature, an NMEA receiver is expected to understand the
+ * MTK standby command.
+ * @param mode The flight mode (MODE_*)
  */
-void print_position(gps_pos *pos)
+void gps_power(ubyte mode)
+{
+    ubyte level = gps_policy(mode);
+
+    if (gps.magic != GPS_MAGIC) { return; }
+    if (level != GPS_POWER_BACKUP && gps.asleep) { gps_wake(); }
+
+    serial_channel(SELECT_GPS);
+    if (level != gps.power && gps.ubx) {
+        ubx_power_save(level != GPS_POWER_FULL);
+    }
+    gps.power = level;
+
+    if (level == GPS_POWER_BACKUP && !gps.asleep && gps.last.age == 0) {
+        if (gps.ubx) { ubx_backup(); }
+        else { printf("$PMTK161,0*28\r\n"); }
+        gps.asleep = TRUE;
+        gps.cycles = 0;
+    }
+    serial_channel(SELECT_PC);
+}
+
+
+/**
+ * Count a cycle of the power policy.
+ * @return True iff the receiver sleeps through this cycle, false if it is (to be) awake
+ */
+ubyte gps_skip(void)
+{
+    if (gps.magic != GPS_MAGIC || !gps.asleep) { return FALSE; }
+    return (++gps.cycles < GPS_SLEEP_CYCLES);
+}
+
+
+/**
+ * @return The power level of a flight mode (GPS_POWER_*)
+ */
+static ubyte gps_policy(ubyte mode)
+{
+    switch (mode) {
+        case MODE_LANDED:
+            return GPS_POWER_BACKUP;
+        case MODE_PRELAUNCH:
+        case MODE_PRELAUNCH_GPS:
+            return GPS_POWER_SAVE;
+        default:
+            return GPS_POWER_FULL;
+    }
+}
+
+
+/**
+ * Wake the receiver from backup or standby: any activity on its UART does, the bytes themselves
+ * are lost. The time to fix counts from here.
+ */
+static void gps_wake(void)
 {
     ubyte i;
-    
-    printf("\r\nGPS time (UTC): %s\r\nLatitude: ", pos->time);
-    for (i = 0; i < 10; i++) {          // Sizeof latitude within gps_pos
-        if (i == 2) { putch(' '); }     // Put a space after the degrees (dd mm.mmmm output format, easier for google maps)
-        putch(pos->latitude[i]);
+
+    serial_channel(SELECT_GPS);
+    for (i = 0; i < 8; i++) { putch(0xFF); }
+    serial_channel(SELECT_PC);
+    gps.asleep = FALSE;
+    gps.woken = TRUE;
+}
+
+
+/**
+ * Account for the first acquisition after a wake.
+ * @param fixed True iff the receiver got a fix before the deadline
+ * @param ttf Time to fix (ms)
+ */
+static void gps_woken(ubyte fixed, uint16 ttf)
+{
+    gps.woken = FALSE;
+    if (!fixed) {
+        gps.ttf_fails++;
+        event_log(EVENT_GPS_WAKE, UCHAR_MAX);
+        return;
     }
-    printf(" %s\r\nLongitude: ", pos->lat_hemi);
-    for (i = 0; i < 11; i++) {          // Sizeof longitude within gps_pos
-        if (i == 3) { putch(' '); }     // Put a space after the degrees (ddd mm.mmmm output format, easier for google maps)
-        putch(pos->longitude[i]);
+    gps.ttf_last = ttf;
+    if (ttf > gps.ttf_max) { gps.ttf_max = ttf; }
+    gps.ttf_sum += ttf;
+    gps.ttf_count++;
+    event_log(EVENT_GPS_WAKE, (ubyte)((ttf + 999) / 1000));
+}
+
+
+/**
+ * Output GPS information in a human readable format.
+ * @param fix
+ */
+void print_position(gps_fix *fix)
+{
+    printf("\r\nGPS time (UTC): %02u:%02u:%02u\r\nLatitude: ", fix->hours, fix->minutes, fix->seconds);
+    print_coord(fix->latitude, 'N', 'S');
+    printf("\r\nLongitude: ");
+    print_coord(fix->longitude, 'E', 'W');
+    printf("\r\nHeight (m): %ld\r\n", (sint32)fix->altitude);
+    printf("Position fix status: %u\r\n", fix->quality);
+    printf("Satellites in view: %u\r\n", fix->satellites);
+    printf("Horizontal dilution of precision (m): %u.%u\r\n", fix->hdop / 10, fix->hdop % 10);
+    printf("Date (UTC): %02u-%02u-20%02u\r\n", fix->day, fix->month, fix->year);
+    printf("Speed (m/s): %u.%02u, course: %u.%u\r\n", fix->speed / 100, fix->speed % 100, fix->course / 10, fix->course % 10);
+    printf("Vertical speed (m/s): %d.%02u\r\n", fix->climb / 100, (fix->climb < 0 ? -fix->climb : fix->climb) % 100);
+    printf("NMEA sentences rejected: %u checksum errors, %u other\r\n", global_nmea_checksum_errors, global_nmea_rejects);
+    printf("UBX checksum errors: %u\r\n", global_ubx_checksum_errors);
+    printf("Age of the fix (acquisitions): %u, GPS deadlines missed: %u\r\n", fix->age, global_gps_misses);
+    if (gps.ttf_count > 0) {
+        printf("Time to fix after a wake (ms): last %u, mean %lu, max %u, ", gps.ttf_last, gps.ttf_sum / gps.ttf_count, gps.ttf_max);
     }
-    printf(" %s\r\n", pos->lon_hemi);
-    printf("Height (m): %s\r\n", pos->altitude);
-    printf("Position fix status: %s\r\n", pos->pos_fix);
-    printf("Satellites in view: %s\r\n", pos->satellites);
-    printf("Horizontal dilution of precision (m): %s\r\n", pos->dilution);
+    printf("%u wakes with a fix, %u without\r\n", gps.ttf_count, gps.ttf_fails);
 }
 
 
 /**
- * Retrieve characters from the GPS until a complete $GPGGA sentence has been retrieved.
- * @param buf Buffer to parse
- * @param bufsize Size of that buffer
+ * Feed a received character to the NMEA parser. Each sentence is merged into the fix of its epoch
+ * once its checksum has been verified; a sentence with a new time starts a new epoch.
+ * @param c The character
+ * @param fix Fix that receives the epoch whenever a sentence is merged into it
+ * @return The sentences of the epoch so far (NMEA_GGA | ...) if c completed one, NMEA_NONE if not
  */
-static void retr_gpgga_sentence(ubyte *buf, uint16 bufsize)
+ubyte gps_parse(ubyte c, gps_fix *fix)
 {
-    ubyte c = 0, b1, b2, b3, b4, b5, i;
+    if (c == '$') {                 // A new sentence, even if the last one was cut short
+        nmea_start();
+        return NMEA_NONE;
+    }
 
-    // 1. Parse characters until a '$GPGGA' is encountered:
-    while (TRUE) {
-        // 1a. Discard all characters until a '$' appears:
-        while (c != '$') { c = getc_uart(); }   // getc_uart() implementation is blocking
+    switch (nmea.state) {
+        case NMEA_ADDRESS:
+        case NMEA_FIELDS:
+            if (c == ',' || c == '*') {
+                if (nmea.state == NMEA_ADDRESS) {
+                    nmea.sentence = nmea_address();
+                    nmea.state = NMEA_FIELDS;
+                }
+                else if (nmea.sentence != NMEA_NONE) { nmea_field(); }
+                if (c == '*') { nmea.state = NMEA_CHECKSUM; }
+                else { nmea.checksum ^= c; }
+                nmea.field++;
+                nmea.len = 0;
+                nmea.dot = FALSE;
+                nmea.negative = FALSE;
+                nmea.decimals = 0;
+                nmea.value = 0;
+            }
+            else if (c < ' ' || c > '~') {
+                nmea.state = NMEA_IDLE;     // Line ended before the checksum or garbage: drop it
+                global_nmea_rejects++;
+            }
+            else {
+                nmea.checksum ^= c;
+                if (nmea.state == NMEA_ADDRESS) {
+                    if (nmea.len < NMEA_ADDRESS_SIZE) { nmea.address[nmea.len] = c; }
+                }
+                else if (c >= '0' && c <= '9') {
+                    if (!nmea.dot) { nmea.value = nmea.value * 10 + (c - '0'); }
+                    else if (nmea.decimals < NMEA_MAX_DECIMALS) {
+                        nmea.value = nmea.value * 10 + (c - '0');
+                        nmea.decimals++;
+                    }
+                }
+                else if (c == '.') { nmea.dot = TRUE; }
+                else if (c == '-' && nmea.len == 0) { nmea.negative = TRUE; }
+                if (nmea.len == 0) { nmea.first = c; }
+                if (nmea.len < 255) { nmea.len++; }
+            }
+            break;
 
-        // 1b. Grab five more characters and check to see if it's a GPGGA sentence:
-        b1 = getc_uart(); b2 = getc_uart(); b3 = getc_uart();
-        b4 = getc_uart(); b5 = getc_uart();
-        if (b1 == 'G' && b2 == 'P' && b3 == 'G' && b4 == 'G' && b5 == 'A') {
-            buf[0] = '$'; buf[1] = 'G'; buf[2] = 'P';
-            buf[3] = 'G'; buf[4] = 'G'; buf[5] = 'A';
-            i = 6;
+        case NMEA_CHECKSUM:
+            if (hex_value(c) > 0x0F) {
+                nmea.state = NMEA_IDLE;
+                global_nmea_checksum_errors++;
+                break;
+            }
+            nmea.received = (nmea.received << 4) | hex_value(c);
+            if (++nmea.len == 2) {
+                nmea.state = NMEA_IDLE;
+                if (nmea.received != nmea.checksum) { global_nmea_checksum_errors++; }
+                else if (nmea.sentence != NMEA_NONE) {
+                    nmea_merge();
+                    memcpy(fix, &nmea.epoch, sizeof(gps_fix));
+                    return nmea.epoch.sentences;
+                }
+            }
+            break;
+
+        case NMEA_IDLE:
+        default:
             break;
-        }
     }
+    return NMEA_NONE;
+}
 
-    // 2. If so, read and copy the rest into the buffer until the LF is encountered:
-    while (i < bufsize && c != '\n') {
-        c = getc_uart();    // Wait for a character to arrive
-        // Copy the character to the buffer if it's not a CR or LF:
-        if (c != '\r' && c != '\n') {
-            buf[i] = c;
-            i++;
-        }
-        else { break; }
+
+/**
+ * Start parsing a sentence after its '$'.
+ */
+static void nmea_start(void)
+{
+    nmea.state = NMEA_ADDRESS;
+    nmea.sentence = NMEA_NONE;
+    nmea.field = 0;
+    nmea.checksum = 0;
+    nmea.received = 0;
+    nmea.len = 0;
+    memset(&nmea.fix, '\0', sizeof(gps_fix));
+}
+
+
+/**
+ * @return True iff the talker id of the received address is that of a satellite navigation
+ * receiver: GPS (GP), GLONASS (GL), Galileo (GA), BeiDou (BD or GB) or a combination (GN)
+ */
+static ubyte nmea_talker(void)
+{
+    ubyte t0 = nmea.address[0], t1 = nmea.address[1];
+
+    if (t0 == 'G') { return (t1 == 'P' || t1 == 'N' || t1 == 'L' || t1 == 'A' || t1 == 'B'); }
+    return (t0 == 'B' && t1 == 'D');
+}
+
+
+/**
+ * @return The sentence the received address stands for, NMEA_NONE for sentences that are skipped
+ */
+static ubyte nmea_address(void)
+{
+    ubyte sentence = NMEA_NONE;
+
+    if (nmea.len != NMEA_ADDRESS_SIZE) { return NMEA_NONE; }    // Proprietary ($P...) or malformed
+    if (nmea.address[2] == 'G' && nmea.address[3] == 'G' && nmea.address[4] == 'A') { sentence = NMEA_GGA; }
+    if (nmea.address[2] == 'R' && nmea.address[3] == 'M' && nmea.address[4] == 'C') { sentence = NMEA_RMC; }
+    if (nmea.address[2] == 'V' && nmea.address[3] == 'T' && nmea.address[4] == 'G') { sentence = NMEA_VTG; }
+
+    // Any constellation will do, the talker id only tells which one the fix is from:
+    if (sentence != NMEA_NONE && !nmea_talker()) {
+        global_nmea_rejects++;
+        return NMEA_NONE;
     }
+    return sentence;
 }
 
+
 /**
- * Parse the buffer containing a GPGGA sentence into its constituents.
- * @param pos gps_pos structure that will be holding the GPS information
- * @param buf string buffer containing the GPGGA sentence
- * @param bufsize size of the buffer
+ * Store the field that has just been received in the fix. Empty fields leave it zero.
  */
-static ubyte parse_gpgga(gps_pos *pos)
+static void nmea_field(void)
 {
-    sint16 index = 0;
-    ubyte tok[8];
+    if (nmea.len == 0) { return; }
 
-    // Make copy of the buffer since it will be modified by the strtok function:
-    memset(tok,         '\0', sizeof(tok));
-    memset(pos,         '\0', sizeof(gps_pos));
+    switch (nmea.sentence) {
+        case NMEA_GGA: gga_field(); break;
+        case NMEA_RMC: rmc_field(); break;
+        case NMEA_VTG: vtg_field(); break;
+        default: break;
+    }
+}
 
-    // First token must be $GPGGA:
-    index = next_token(global_gps_buf, index, tok, sizeof(tok));
-    if (strcmp(tok, "$GPGGA")) { return FALSE; }
 
-    // Parse GPS info: $GPGGA,time,lat,N/S,lon,W/E,fix,satellites,dilution,altitude,M,sep,M,age,id*CS
-    index = next_token(global_gps_buf, index, pos->time, sizeof(pos->time));
-    index = next_token(global_gps_buf, index, pos->latitude, sizeof(pos->latitude));
-    index = next_token(global_gps_buf, index, pos->lat_hemi, sizeof(pos->lat_hemi));
-    index = next_token(global_gps_buf, index, pos->longitude, sizeof(pos->longitude));
-    index = next_token(global_gps_buf, index, pos->lon_hemi, sizeof(pos->lon_hemi));
-    index = next_token(global_gps_buf, index, pos->pos_fix, sizeof(pos->pos_fix));
-    index = next_token(global_gps_buf, index, pos->satellites, sizeof(pos->satellites));
-    index = next_token(global_gps_buf, index, pos->dilution, sizeof(pos->dilution));
-    index = next_token(global_gps_buf, index, pos->altitude, sizeof(pos->altitude));
+static void gga_field(void)
+{
+    uint32 t;
 
-    return TRUE;
+    switch (nmea.field) {
+        case GGA_TIME:
+            field_time();
+            break;
+        case GGA_LAT:                   // ddmm.mmmm
+        case GGA_LON:                   // dddmm.mmmm
+            if (nmea.field == GGA_LAT) { nmea.fix.latitude = field_coord(); }
+            else { nmea.fix.longitude = field_coord(); }
+            break;
+        case GGA_LAT_HEMI:
+            if (nmea.first == 'S') { nmea.fix.latitude = -nmea.fix.latitude; }
+            break;
+        case GGA_LON_HEMI:
+            if (nmea.first == 'W') { nmea.fix.longitude = -nmea.fix.longitude; }
+            break;
+        case GGA_QUALITY:
+            nmea.fix.quality = (ubyte)field_value(0);
+            break;
+        case GGA_SATELLITES:
+            nmea.fix.satellites = (ubyte)field_value(0);
+            break;
+        case GGA_HDOP:
+            t = field_value(1);
+            nmea.fix.hdop = (t > USHRT_MAX) ? USHRT_MAX : (uint16)t;
+            break;
+        case GGA_ALTITUDE:              // Meters, truncated
+            t = field_value(0);
+            if (t > SHRTLONG_MAX) { t = SHRTLONG_MAX; }
+            nmea.fix.altitude = nmea.negative ? -(sint24)t : (sint24)t;
+            break;
+        default:
+            break;
+    }
 }
 
-/* Tokenize the given buffer from index onwards and copy the token into the given
- output buffer, taking care not to exceed its size. Return the index from whence
- the next call can be made. */
-static uint16 next_token(ubyte *buf, sint16 index, ubyte *dest, uint16 dest_size)
-{
-    ubyte c;
-    ubyte out_i = 0;
-    
-    if (index < 0) { return index; }
-    
-    dest_size--; // ensure null-termination
-    
-    c = buf[index++];
-    while (c != ',') {
-        if (c == '\0') { return -1; }
-        
-        if (out_i < dest_size) { // make the copy if output buf size allows
-            dest[out_i++] = c;
-        }
-        
-        c = buf[index++];
+
+static void rmc_field(void)
+{
+    uint32 t;
+
+    switch (nmea.field) {
+        case RMC_TIME:
+            field_time();
+            break;
+        case RMC_SPEED:                 // 0.01 knots to cm/s: multiply by 1852 / 3600
+            t = field_value(2) * 1852 / 3600;
+            nmea.fix.speed = (t > USHRT_MAX) ? USHRT_MAX : (uint16)t;
+            break;
+        case RMC_COURSE:
+            nmea.fix.course = (uint16)field_value(1);
+            break;
+        case RMC_DATE:
+            t = field_value(0);
+            nmea.fix.day = (ubyte)(t / 10000);
+            nmea.fix.month = (ubyte)(t / 100 % 100);
+            nmea.fix.year = (ubyte)(t % 100);
+            break;
+        default:
+            break;
+    }
+}
+
+
+static void vtg_field(void)
+{
+    uint32 t;
+
+    switch (nmea.field) {
+        case VTG_COURSE:
+            nmea.fix.course = (uint16)field_value(1);
+            break;
+        case VTG_SPEED:                 // 0.01 km/h to cm/s: multiply by 10 / 36
+            t = field_value(2) * 10 / 36;
+            nmea.fix.speed = (t > USHRT_MAX) ? USHRT_MAX : (uint16)t;
+            break;
+        default:
+            break;
     }
-    
-    dest[out_i] = '\0';
-    return index;
+}
+
+
+/**
+ * Store a hhmmss.ss time field (fractions of seconds are truncated).
+ */
+static void field_time(void)
+{
+    uint32 t = field_value(0);
+
+    nmea.fix.hours = (ubyte)(t / 10000);
+    nmea.fix.minutes = (ubyte)(t / 100 % 100);
+    nmea.fix.seconds = (ubyte)(t % 100);
+}
+
+
+/**
+ * Merge the sentence that has just been received into the fix of its epoch. GGA and RMC carry the
+ * time of the epoch, VTG belongs to the epoch of the sentence before it. RMC and VTG both carry
+ * speed and course, VTG only counts for a GPS that leaves them out of RMC.
+ */
+static void nmea_merge(void)
+{
+    gps_fix *e = &nmea.epoch;
+
+    if (nmea.sentence != NMEA_VTG && (e->sentences == NMEA_NONE || e->hours != nmea.fix.hours || \
+            e->minutes != nmea.fix.minutes || e->seconds != nmea.fix.seconds)) {
+        memset(e, '\0', sizeof(gps_fix));   // A new epoch
+        e->hours = nmea.fix.hours;
+        e->minutes = nmea.fix.minutes;
+        e->seconds = nmea.fix.seconds;
+    }
+
+    switch (nmea.sentence) {
+        case NMEA_GGA:
+            e->quality = nmea.fix.quality;
+            e->satellites = nmea.fix.satellites;
+            e->hdop = nmea.fix.hdop;
+            e->latitude = nmea.fix.latitude;
+            e->longitude = nmea.fix.longitude;
+            e->altitude = nmea.fix.altitude;
+            break;
+        case NMEA_RMC:
+            e->day = nmea.fix.day;
+            e->month = nmea.fix.month;
+            e->year = nmea.fix.year;
+            e->speed = nmea.fix.speed;
+            e->course = nmea.fix.course;
+            break;
+        case NMEA_VTG:
+            if (e->sentences & NMEA_RMC) { break; }
+            e->speed = nmea.fix.speed;
+            e->course = nmea.fix.course;
+            break;
+        default:
+            break;
+    }
+    e->sentences |= nmea.sentence;
+}
+
+
+/**
+ * Number of the day of a fix, counting from 1 on 1 january 2000 (up to 36525 on 31 december 2099).
+ * @param fix The fix
+ * @return The day number, or 0 if the fix holds no (valid) date
+ */
+uint16 gps_day_number(gps_fix *fix)
+{
+    static const uint16 month_days[12] = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+    uint16 days;
+
+    if (fix->day < 1 || fix->day > 31 || fix->month < 1 || fix->month > 12) { return 0; }
+
+    // Every fourth year is a leap year between 2000 and 2099:
+    days = (uint16)fix->year * 365 + (fix->year + 3) / 4 + month_days[fix->month - 1] + fix->day;
+    if (fix->month > 2 && fix->year % 4 == 0) { days++; }
+    return days;
+}
+
+
+/**
+ * @param decimals Number of decimals wanted
+ * @return The field received, scaled to that number of decimals (extra decimals are truncated)
+ */
+static uint32 field_value(ubyte decimals)
+{
+    uint32 v = nmea.value;
+    ubyte d = nmea.decimals;
+
+    for (; d < decimals; d++) { v *= 10; }
+    for (; d > decimals; d--) { v /= 10; }
+    return v;
+}
+
+
+/**
+ * @return The (dd)dmm.mmmm coordinate received, in micro-degrees
+ */
+static sint32 field_coord(void)
+{
+    uint32 v;
+
+    // 1e-4 minutes to micro-degrees: multiply by 10 / 6 (rounded):
+    v = field_value(4);
+    return (sint32)(v / 1000000 * 1000000 + (v % 1000000 * 10 + 3) / 6);
+}
+
+
+/**
+ * @return The value of a hex digit (upper case, as in NMEA checksums), 0xFF if c is not one
+ */
+static ubyte hex_value(ubyte c)
+{
+    if (c >= '0' && c <= '9') { return c - '0'; }
+    if (c >= 'A' && c <= 'F') { return c - 'A' + 10; }
+    return 0xFF;
+}
+
+
+/**
+ * Print a coordinate in micro-degrees as degrees with six decimals and the hemisphere.
+ */
+static void print_coord(sint32 coord, ubyte pos, ubyte neg)
+{
+    uint32 a = (coord < 0) ? (uint32)-coord : (uint32)coord;
+
+    printf("%lu.%06lu %c", a / 1000000, a % 1000000, (coord < 0) ? neg : pos);
 }
@@ -16,26 +16,65 @@ extern "C" {
 
 #include "defs.h"
 
-// Buffer to hold complete NMEA sentences:
-#define NMEA_BUF_SIZE 100
-extern ubyte global_gps_buf[NMEA_BUF_SIZE];
+/**
+ * A GPS fix as parsed from the NMEA sentences of one epoch (GGA, RMC and VTG with the same time),
+ * all fields numeric. Fields that the GPS left empty, or that come from a sentence that was not
+ * received, are zero.
+ */
+typedef struct {
+    ubyte       sentences;          // The sentences merged into the fix (NMEA_GGA | NMEA_RMC | NMEA_VTG)
+    ubyte       hours;              // UTC time
+    ubyte       minutes;
+    ubyte       seconds;
+    ubyte       day;                // UTC date (RMC), day 0 if unknown
+    ubyte       month;
+    ubyte       year;               // Years since 2000
+    ubyte       quality;            // GGA fix quality: 0 no fix, 1 GPS fix, 2 differential GPS fix
+    ubyte       satellites;         // Number of satellites in use
+    uint16      hdop;               // Horizontal dilution of precision in 0.1 units
+    sint32      latitude;           // Micro-degrees, north positive
+    sint32      longitude;          // Micro-degrees, east positive
+    sint24      altitude;           // Meters above mean sea level
+    uint16      speed;              // Speed over ground in cm/s (RMC or VTG)
+    uint16      course;             // Course over ground in 0.1 degrees from true north (RMC or VTG)
+    sint16      climb;              // Vertical speed in cm/s, up positive (UBX only)
+    ubyte       age;                // Acquisitions since the fix was received: 0 if it is fresh
+} gps_fix;
 
+// Deadline of get_position() in the flight cycle: leaves the rest of the watchdog period (about
+// 33 s) for logging and sending the record.
+#define GPS_DEADLINE_MS     10000
 
-typedef struct {
-    ubyte time[12];         // hhmmss.ssss format
-    ubyte latitude[10];     // ddmm.mmmm format (including dot and leading zeroes)
-    ubyte lat_hemi[2];      // N or S
-    ubyte longitude[11];    // dddmm.mmmm format (including dot and leading zeroes)
-    ubyte lon_hemi[2];      // E or W
-    ubyte pos_fix[2];       // 0: no fix, 1: valid, SPS; 2: valid, differential GPS
-    ubyte satellites[3];    // Number of satellites in view
-    ubyte dilution[6];      // Dilution precision 00.0 - 99.9
-    ubyte altitude[10];     // -9999.9 - 17999.9
-} gps_pos;
-
-
-ubyte get_position(gps_pos *pos);
-void print_position(gps_pos *pos);
+// Acquisitions that returned the last valid fix because the GPS missed the deadline:
+extern uint16 global_gps_misses;
+
+// Power levels of the receiver (see gps_power()):
+#define GPS_POWER_FULL      0       // Continuous tracking
+#define GPS_POWER_SAVE      1       // Tracking in cycles, asleep in between (UBX power save mode)
+#define GPS_POWER_BACKUP    2       // Asleep between fixes, woken every GPS_SLEEP_CYCLES cycles
+#define GPS_POWER_UNKNOWN   0xFF    // After the receiver has been configured again: gps_power() sets it again
+#define GPS_SLEEP_CYCLES    6       // About 3.5 minutes between the fixes once landed
+
+// Sentences rejected by gps_parse():
+extern uint16 global_nmea_checksum_errors;  // Sentences with a checksum that does not match
+extern uint16 global_nmea_rejects;          // Sentences cut short, or from an unknown talker
+
+// Sentences recognized by gps_parse(), as bits:
+#define NMEA_NONE       0x00        // No sentence completed (yet), or one that is not used
+#define NMEA_GGA        0x01        // Time, position and fix quality
+#define NMEA_RMC        0x02        // Time, date, speed and course
+#define NMEA_VTG        0x04        // Speed and course
+#define NMEA_EPOCH      (NMEA_GGA | NMEA_RMC)   // A complete fix
+
+
+ubyte init_gps(ubyte cold);
+ubyte get_position(gps_fix *fix, uint16 deadline_ms);
+void  gps_last_fix(gps_fix *fix);
+void  gps_power(ubyte mode);
+ubyte gps_skip(void);
+void  print_position(gps_fix *fix);
+ubyte gps_parse(ubyte c, gps_fix *fix);
+uint16 gps_day_number(gps_fix *fix);
 
 #ifdef	__cplusplus
 }
@@ -8,8 +8,10 @@
  */
 
 #include "gsm.h"
+#include "geo.h"
 #include "serial.h"
 #include "util.h"
+#include "events.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -58,6 +60,7 @@ void enable_gsm(void)
     printf("OK\r\n");
     
     global_config.status.gsm_on = 1;
+    event_log(EVENT_GSM, 1);
 }
 
 /**
@@ -71,6 +74,7 @@ void disable_gsm(void)
     printf("OK\r\n");
     
     global_config.status.gsm_on = 0;
+    event_log(EVENT_GSM, 0);
 }
 
 
@@ -102,8 +106,8 @@ void send_sms(ubyte *msg)
  */
 void send_sms_record(record *rec)
 {
-    ubyte lat[12];
-    ubyte lon[13];
+    ubyte lat[GEO_DDMM_SIZE + 1];   // With the hemisphere
+    ubyte lon[GEO_DDMM_SIZE + 1];
     sint16 temp_in, temp_ex;
     uint24 temp;
     sint32 pf24bfix;
@@ -125,30 +129,10 @@ void send_sms_record(record *rec)
     temp_in = ((sint16)(temp & 0x000fff)) / 10;
     temp_ex = ((sint16)(temp >> 12)) / 16;
 
-    lat[0] = rec->ru.telemetry.latitude[0];
-    lat[1] = rec->ru.telemetry.latitude[1];
-    lat[2] = '+';
-    lat[3] = rec->ru.telemetry.latitude[2];
-    lat[4] = rec->ru.telemetry.latitude[3];
-    lat[5] = '.';
-    lat[6] = rec->ru.telemetry.latitude[4];
-    lat[7] = rec->ru.telemetry.latitude[5];
-    lat[8] = rec->ru.telemetry.latitude[6];
-    lat[9] = rec->ru.telemetry.latitude[7];
-    lat[10] = (rec->ru.telemetry.status2.north_hemi == 1) ? 'N': 'S';
-    
-    lon[0] = rec->ru.telemetry.longitude[0];
-    lon[1] = rec->ru.telemetry.longitude[1];
-    lon[2] = rec->ru.telemetry.longitude[2];
-    lon[3] = '+';
-    lon[4] = rec->ru.telemetry.longitude[3];
-    lon[5] = rec->ru.telemetry.longitude[4];
-    lon[6] = '.';
-    lon[7] = rec->ru.telemetry.longitude[5];
-    lon[8] = rec->ru.telemetry.longitude[6];
-    lon[9] = rec->ru.telemetry.longitude[7];
-    lon[10] = rec->ru.telemetry.longitude[8];
-    lon[11] = (rec->ru.telemetry.status2.east_hemi == 1) ? 'E': 'W';
+    geo_ddmm(rec->ru.telemetry.latitude, 2, '+', lat);
+    lat[10] = (rec->ru.telemetry.latitude >= 0) ? 'N': 'S';
+    geo_ddmm(rec->ru.telemetry.longitude, 3, '+', lon);
+    lon[11] = (rec->ru.telemetry.longitude >= 0) ? 'E': 'W';
     
     pf24bfix = (sint32)rec->ru.telemetry.alt_gps;
     printf("MHAB%u %u%u %ldm http://maps.google.com/maps?q=%s,%s %dTi %dTe", \
@@ -8,11 +8,55 @@
  */
 
 #include "i2c.h"
+#include "util.h"
+
+#include <stddef.h>
+
+
+// Engine states, named after the bus action whose completion the next SSPIF interrupt signals:
+#define ST_IDLE                 0
+#define ST_START                1       // Start condition
+#define ST_ADDR_W               2       // Address byte with the write bit
+#define ST_WRITE                3       // Register or data byte
+#define ST_RESTART              4       // Repeated start condition
+#define ST_ADDR_R               5       // Address byte with the read bit
+#define ST_READ                 6       // Data byte received
+#define ST_ACK                  7       // ACK or NACK of a received byte
+#define ST_STOP                 8       // Stop condition
+
+// Speed profiles: SSPADD = (Fosc / baudrate) / 4 - 1 @20 MHz (400 kHz rounds down to 385 kHz)
+static const ubyte i2c_sspadd[I2C_SPEEDS] = {49, 12};
+
+// Speed profile per device on the bus:
+static ubyte i2c_speed_eeprom = I2C_EEPROM_SPEED;
+static ubyte i2c_speed_bmp180 = I2C_BMP180_SPEED;
+static ubyte i2c_speed_ds3231 = I2C_DS3231_SPEED;
+static ubyte i2c_speed;                 // Current speed of the bus
+
+// Transaction queue, the transaction at the head is on the bus:
+static i2c_txn *i2c_queue[I2C_QUEUE_SIZE];
+static volatile ubyte i2c_head;
+static volatile ubyte i2c_count;
+static ubyte i2c_state;                 // ST_*
+static uint16 i2c_idx;                  // Byte of the register, write or read data being transferred
+static uint16 i2c_polls;                // Address NACKs of an I2C_FLAG_POLL transaction so far
+static ubyte i2c_result;                // Status to report once the stop condition is done
+
+// Global variables
+ubyte global_i2c_error = I2C_OK;
+uint16 global_i2c_errors = 0;
+
+static ubyte *device_speed(ubyte addr);
+static void i2c_device(ubyte addr);
+static void i2c_begin(void);
+static void i2c_end(ubyte status);
+static void i2c_expire(void);
+static void i2c_reset(void);
+static ubyte eeprom_txn(i2c_txn *t, const uint16 addr, const ubyte high);
+
 
 void init_i2c(void)
 {
-    ubyte dummy;
-
     // Set both SDA and SCL pins as inputs:
     I2C_SDA_DIR = INPUT;
     I2C_SCL_DIR = INPUT;
@@ -20,134 +64,305 @@ void init_i2c(void)
     // Configure hardware I2C:
     SSPSTAT =   0x80;           // Disable SLEW RATE for 100 kHz
     SSPADD =    49;             // 100Khz operation @20 MHz (Fosc / baudrate) / 4 - 1
-    SSPCON1 =   0x28;           // Set SSPEN bit: SCL and SDA are open-drain now, MASTER mode, clock = (Fosc/4)*(SSPADD+1)
-    SSPCON2 =   0x00;           // Clear all
-    dummy =     SSPBUF;         // Dummy read to completely clear the SSPBUF buffer
-
-    PIR1bits.SSPIF = 0;
-    PIR2bits.BCLIF = 0;
+    i2c_speed = I2C_SPEED_100KHZ;
+    i2c_head = 0;
+    i2c_count = 0;
+    i2c_reset();
+
+    // The engine is driven by the MSSP and bus collision interrupts:
+    PIE1bits.SSPIE = SET;
+    PIE2bits.BCLIE = SET;
 }
 
 /**
- * Close the SSP module and with it I2C.
+ * Close the SSP module and with it I2C. Queued transactions are completed first.
  */
 void close_i2c(void)
 {
+    while (i2c_count > 0) { i2c_expire(); }
+    PIE1bits.SSPIE = CLEAR;
+    PIE2bits.BCLIE = CLEAR;
     SSPCON1bits.SSPEN = 0;      // Disable the SSP module to conserve power.
 }
 
 
 /**
- * This function will be in a wait state until Start Condition Enable bit,
- * Stop Condition Enable bit, Receive Enable bit, Acknowledge Sequence
- * Enable bit of I2C Control register and Transmit Status bit I2C Status
- * register are clear. The IdleI2C function is required since the hardware
- * I2C peripheral does not allow for spooling of bus sequence. The I2C
- * peripheral must be in Idle state before an I2C operation can be initiated
- * or write collision will be generated.
+ * Switch the bus to the speed profile of a device. The bus must be idle.
+ * @param addr Address (or control byte) of the device
  */
-void i2c_idle( void )
+static void i2c_device(ubyte addr)
 {
-    while ((SSPSTATbits.R_W) | (SSPCON2 & 0x1F));
+    ubyte *speed = device_speed(addr);
+    ubyte s = speed ? *speed : I2C_SPEED_100KHZ;    // Unknown devices get standard mode
+
+    if (s == i2c_speed) { return; }
+    SSPADD = i2c_sspadd[s];
+    SSPSTATbits.SMP = (s == I2C_SPEED_100KHZ);      // Slew rate control is only meant for 400 kHz
+    i2c_speed = s;
 }
 
+
 /**
- * Send ACK bit
+ * Change the speed profile of a device.
+ * @param addr Address (or control byte) of the device
+ * @param speed I2C_SPEED_100KHZ or I2C_SPEED_400KHZ
  */
-void i2c_ack(void)
+void i2c_set_speed(ubyte addr, ubyte speed)
 {
-    i2c_idle();
-    SSPCON2bits.ACKDT = I2C_ACK;
-    SSPCON2bits.ACKEN = 1;
-    while(SSPCON2bits.ACKEN);
-    PIR1bits.SSPIF = 0;
+    ubyte *s = device_speed(addr);
+
+    if (s && speed < I2C_SPEEDS) { *s = speed; }
 }
 
+
 /**
- * Send non-ack to end the transaction
+ * Look up the speed profile of a device.
+ * @return The speed of the device, or NULL for an unknown device
  */
-void i2c_nack(void)
+static ubyte *device_speed(ubyte addr)
 {
-    i2c_idle();
-    SSPCON2bits.ACKDT = I2C_NACK;
-    SSPCON2bits.ACKEN = 1;
-    while(SSPCON2bits.ACKEN);
-    PIR1bits.SSPIF = 0;
+    if ((addr & 0xF0) == I2C_EEPROM_ADDR) { return &i2c_speed_eeprom; }    // Block and chip select bits
+    if ((addr & 0xFE) == I2C_BMP180_ADDR) { return &i2c_speed_bmp180; }
+    if ((addr & 0xFE) == I2C_DS3231_ADDR) { return &i2c_speed_ds3231; }
+    return NULL;
 }
 
+
 /**
- * Generate the start condition for I2C:
+ * Queue a transaction, it is carried out in the background by the interrupt routine. Waits while
+ * the queue is full.
+ * @param t The transaction, it must stay in place until its status is no longer I2C_PENDING
+ * @param timeout_ms Milliseconds the transaction may take once it is on the bus
  */
-void i2c_start(void)
+void i2c_submit(i2c_txn *t, uint16 timeout_ms)
 {
-    i2c_idle();                 // Wait for bus to be idle before doing anything
-    SSPCON2bits.SEN = 1;        // Raise start condition
-    while(SSPCON2bits.SEN);     // Wait for start condition to clear
-    PIR1bits.SSPIF = 0;
+    while (i2c_count == I2C_QUEUE_SIZE) { i2c_expire(); }
+
+    t->status = I2C_PENDING;
+    di();
+    t->deadline = timeout_ms;
+    i2c_queue[(i2c_head + i2c_count) % I2C_QUEUE_SIZE] = t;
+    if (++i2c_count == 1) { i2c_begin(); }
+    ei();
 }
 
+
 /**
- * Generate the restart condition for I2C:
+ * Wait for a queued transaction to complete or to pass its deadline.
+ * @return The status of the transaction: I2C_OK or an error code
  */
-void i2c_restart(void)
+ubyte i2c_wait(i2c_txn *t)
 {
-    i2c_idle();                 // Wait for bus to be idle before doing anything
-    SSPCON2bits.RSEN = 1;       // Raise restart condition
-    while(SSPCON2bits.RSEN);    // Wait for restart condition to clear
-    PIR1bits.SSPIF = 0;
+    while (t->status == I2C_PENDING) { i2c_expire(); }
+    return t->status;
 }
 
+
 /**
- * Generate the stop condition for I2C:
+ * Queue a transaction and wait for it to complete.
+ * @return The status of the transaction: I2C_OK or an error code
  */
-void i2c_stop(void)
+ubyte i2c_transfer(i2c_txn *t, uint16 timeout_ms)
 {
-    i2c_idle();
-    SSPCON2bits.PEN = 1;
-    while(SSPCON2bits.PEN);
-    PIR1bits.SSPIF = 0;
+    i2c_submit(t, timeout_ms);
+    return i2c_wait(t);
 }
 
+
 /**
- * Write a byte of data to the I2C bus.
- * @param data The byte to be written
- * @return True iff the write went OK
+ * Give up the transaction on the bus if its deadline has passed: the bus is reset and the next
+ * transaction is started. A transaction behind it in the queue can only expire once it is on the
+ * bus itself, so each one gets its chance.
  */
-ubyte i2c_write(const ubyte data)
+static void i2c_expire(void)
 {
-    i2c_idle();
-    SSPBUF = data;
-    if (SSPCON1bits.WCOL) {             // Check for write collision
-        SSPCON1bits.WCOL = 0;
-        return FALSE;
+    di();
+    if (i2c_count > 0 && (sint16)(global_ms_ticks - i2c_queue[i2c_head]->deadline) >= 0) {
+        i2c_reset();
+        i2c_end(I2C_ERR_TIMEOUT);
     }
-    while (SSPSTATbits.BF);             // BF cleared after falling edge of the eighth clock
-    i2c_idle();                         // Wait for the bus to be idle
-    PIR1bits.SSPIF = 0;                 // Not sure
-    return (SSPCON2bits.ACKSTAT == 0);  // True if there was an ack from the slave
+    ei();
 }
 
+
+/**
+ * Reset the MSSP module, which releases the bus, and clear its interrupt flags.
+ */
+static void i2c_reset(void)
+{
+    ubyte dummy;
+
+    SSPCON1 =   0x08;           // Disable the module, I2C master mode
+    SSPCON2 =   0x00;           // Clear all
+    SSPCON1 =   0x28;           // Set SSPEN bit: SCL and SDA are open-drain now, MASTER mode, clock = (Fosc/4)*(SSPADD+1)
+    dummy =     SSPBUF;         // Dummy read to completely clear the SSPBUF buffer
+    PIR1bits.SSPIF = 0;
+    PIR2bits.BCLIF = 0;
+    i2c_state = ST_IDLE;
+}
+
+
+/**
+ * Put the transaction at the head of the queue on the bus. Called from the interrupt routine or
+ * with interrupts disabled, while the bus is idle.
+ */
+static void i2c_begin(void)
+{
+    i2c_device(i2c_queue[i2c_head]->addr);
+    i2c_queue[i2c_head]->deadline += global_ms_ticks;  // The time spent in the queue does not count
+    i2c_polls = 0;
+    i2c_state = ST_START;
+    SSPCON2bits.SEN = 1;
+}
+
+
 /**
- * Read a byte from the I2C bus
- * @param buf On success, buf will be filled with the received byte.
- * @return True iff the read went OK
+ * Complete the transaction at the head of the queue and start the next one. Called from the
+ * interrupt routine or with interrupts disabled.
+ * @param status Status of the transaction
  */
-ubyte i2c_read(ubyte *buf)
+static void i2c_end(ubyte status)
 {
-    i2c_idle();
-    SSPCON2bits.RCEN = 1;
-    if (SSPCON1bits.SSPOV || SSPCON1bits.WCOL) {
-        SSPCON1bits.SSPOV = 0;
-        SSPCON1bits.WCOL = 0;
-        return FALSE;
+    i2c_queue[i2c_head]->status = status;
+    if (status != I2C_OK) {
+        global_i2c_error = status;
+        global_i2c_errors++;
     }
+    i2c_head = (i2c_head + 1) % I2C_QUEUE_SIZE;
+    i2c_state = ST_IDLE;
+    if (--i2c_count > 0) { i2c_begin(); }
+}
+
+
+/**
+ * Interrupt routine of the engine, called on SSPIF (a bus action completed) and BCLIF (bus
+ * collision). Each bus action is started here as soon as the previous one completes.
+ */
+void i2c_isr(void)
+{
+    i2c_txn *t;
+    uint16 n;
 
-    while (SSPCON2bits.RCEN);   // Wait until (BF is set) and RCEN is cleared
+    if (PIR2bits.BCLIF) {           // Collision: the MSSP is idle again, give up the transaction
+        i2c_reset();
+        if (i2c_count > 0) { i2c_end(I2C_ERR_COLLISION); }
+        return;
+    }
     PIR1bits.SSPIF = 0;
-    *buf = SSPBUF;
-    return TRUE;
+    if (i2c_count == 0 || i2c_state == ST_IDLE) { return; }
+    t = i2c_queue[i2c_head];
+
+    switch (i2c_state) {
+        case ST_START:
+            // A transaction without anything to write starts reading right away:
+            if (t->reg_len == 0 && t->wlen == 0 && t->rlen > 0) {
+                i2c_state = ST_ADDR_R;
+                SSPBUF = t->addr | I2C_READ;
+            }
+            else {
+                i2c_state = ST_ADDR_W;
+                SSPBUF = t->addr | I2C_WRITE;
+            }
+            i2c_idx = 0;
+            break;
+
+        case ST_ADDR_W:
+        case ST_WRITE:
+            if (SSPCON2bits.ACKSTAT) {  // NACK: stop, and start over while an EEPROM is busy writing
+                i2c_result = (i2c_state == ST_ADDR_W && (t->flags & I2C_FLAG_POLL) && ++i2c_polls < I2C_MAX_POLLS) ? I2C_PENDING : I2C_ERR_NACK;
+                i2c_state = ST_STOP;
+                SSPCON2bits.PEN = 1;
+            }
+            else if (i2c_idx < t->reg_len) {
+                i2c_state = ST_WRITE;
+                SSPBUF = t->reg[i2c_idx++];
+            }
+            else if ((n = i2c_idx - t->reg_len) < t->wlen) {
+                i2c_state = ST_WRITE;
+                i2c_idx++;
+                SSPBUF = t->wbuf[n];
+            }
+            else if (t->rlen > 0) {
+                i2c_state = ST_RESTART;
+                SSPCON2bits.RSEN = 1;
+            }
+            else {
+                i2c_result = I2C_OK;
+                i2c_state = ST_STOP;
+                SSPCON2bits.PEN = 1;
+            }
+            break;
+
+        case ST_RESTART:
+            i2c_state = ST_ADDR_R;
+            SSPBUF = t->addr | I2C_READ;
+            break;
+
+        case ST_ADDR_R:
+            i2c_idx = 0;
+            if (SSPCON2bits.ACKSTAT) {
+                i2c_result = I2C_ERR_NACK;
+                i2c_state = ST_STOP;
+                SSPCON2bits.PEN = 1;
+            }
+            else {
+                i2c_state = ST_READ;
+                SSPCON2bits.RCEN = 1;
+            }
+            break;
+
+        case ST_READ:
+            t->rbuf[i2c_idx++] = SSPBUF;
+            SSPCON2bits.ACKDT = (i2c_idx < t->rlen) ? I2C_ACK : I2C_NACK;    // NACK the last byte
+            SSPCON2bits.ACKEN = 1;
+            i2c_state = ST_ACK;
+            break;
+
+        case ST_ACK:
+            if (i2c_idx < t->rlen) {
+                i2c_state = ST_READ;
+                SSPCON2bits.RCEN = 1;
+            }
+            else {
+                i2c_result = I2C_OK;
+                i2c_state = ST_STOP;
+                SSPCON2bits.PEN = 1;
+            }
+            break;
+
+        case ST_STOP:
+            if (i2c_result == I2C_PENDING) {    // Poll again
+                i2c_state = ST_START;
+                SSPCON2bits.SEN = 1;
+            }
+            else { i2c_end(i2c_result); }
+            break;
+    }
 }
 
+
+/**
+ * Prepare a transaction with the 24LC1026 EEPROM. Every EEPROM transaction polls the device, so
+ * one that follows a page write waits for its write cycle to finish.
+ * @param addr Lower 16 bits of the address
+ * @param high High bit to select between the high or low block (65K bytes each)
+ * @return The control byte of the block
+ */
+static ubyte eeprom_txn(i2c_txn *t, const uint16 addr, const ubyte high)
+{
+    t->addr = I2C_EEPROM_ADDR | (high ? I2C_24LC1026_HIGH_BLK : I2C_24LC1026_LOW_BLK);
+    t->flags = I2C_FLAG_POLL;
+    t->reg[0] = addr >> 8;
+    t->reg[1] = addr & 0xff;
+    t->reg_len = 2;
+    t->wbuf = NULL;
+    t->wlen = 0;
+    t->rbuf = NULL;
+    t->rlen = 0;
+    return t->addr;
+}
+
+
 /**
  * Write a byte of data into the 24LC1026 EEPROM at the given address.
  * @param addr Lower 16 bits of the address
@@ -157,56 +372,40 @@ ubyte i2c_read(ubyte *buf)
  */
 ubyte i2c_eeprom_byte_write(const uint16 addr, const ubyte high, const ubyte data)
 {
-    ubyte ctl, ah, al;
-
-    // 1. Set control byte (high or low block):
-    ctl = I2C_EEPROM_ADDR | (high ? I2C_24LC1026_HIGH_BLK : I2C_24LC1026_LOW_BLK);
-    al = addr & 0xff;
-    ah = addr >> 8;
-
-    // 2. Write the byte:
-    i2c_start();
-    if (!i2c_write(ctl | I2C_WRITE)) { return FALSE; }
-    if (!i2c_write(ah)) { return FALSE; }
-    if (!i2c_write(al)) { return FALSE; }
-    if (!i2c_write(data)) { return FALSE; }
-    i2c_stop();
-    return TRUE;
+    i2c_txn t;
+
+    eeprom_txn(&t, addr, high);
+    t.wbuf = &data;
+    t.wlen = 1;
+    return (i2c_transfer(&t, I2C_TIMEOUT_MS) == I2C_OK);
 }
 
 /* Write a full page of 128 bytes to the EEPROM based on the data in the given buffer.
  * If more than 128 bytes are given, then the write will wrap around.
- * At the end of the page write, ack polling will be used to wait for the write to complete.
+ * With ack polling the write cycle is waited for, otherwise it goes on in the background and the
+ * next EEPROM transaction waits for it.
  */
 ubyte i2c_eeprom_page_write(const uint16 addr, const ubyte high, const ubyte *buf, uint16 len, ubyte ack_poll)
 {
-    uint16 i, mod_ps;
-    ubyte ctl, ah, al;
-
-    // 1. Set control byte (high or low block):
-    ctl = I2C_EEPROM_ADDR | (high ? I2C_24LC1026_HIGH_BLK : I2C_24LC1026_LOW_BLK);
-    al = addr & 0xff;
-    ah = addr >> 8;
+    i2c_txn t;
+    uint16 mod_ps;
+    ubyte ctl;
 
-    // 2. Check the address and length for rollovers:
+    // 1. Check the address and length for rollovers:
     len = (len < I2C_24LC1026_PAGE_SIZE) ? len : I2C_24LC1026_PAGE_SIZE;    // Cannot write more than page size (128 bytes)
     mod_ps = addr % I2C_24LC1026_PAGE_SIZE;                                 // Calculate address offset within page
     if (mod_ps + len > I2C_24LC1026_PAGE_SIZE) {    // Reduce len to fall to prevent wraparound within the page
         len = I2C_24LC1026_PAGE_SIZE - mod_ps;
     }
 
-    // 3. Write the page:
-    i2c_start();
-    if (!i2c_write(ctl | I2C_WRITE)) { return FALSE; }
-    if (!i2c_write(ah)) { return FALSE; }
-    if (!i2c_write(al)) { return FALSE; }
-    for (i = 0; i < len; i++) {
-        if (!i2c_write(buf[i])) { return FALSE; }
-    }
-    i2c_stop();
+    // 2. Write the page:
+    ctl = eeprom_txn(&t, addr, high);
+    t.wbuf = buf;
+    t.wlen = len;
+    if (i2c_transfer(&t, I2C_TIMEOUT_MS) != I2C_OK) { return FALSE; }
 
-    // 4. Use ack polling to wait for the EEPROM to finish writing the page:
-    if (ack_poll) { i2c_eeprom_ack_polling(ctl | I2C_WRITE); }
+    // 3. Use ack polling to wait for the EEPROM to finish writing the page:
+    if (ack_poll) { return i2c_eeprom_ack_polling(ctl); }
     return TRUE;
 }
 
@@ -219,24 +418,7 @@ ubyte i2c_eeprom_page_write(const uint16 addr, const ubyte high, const ubyte *bu
  */
 ubyte i2c_eeprom_random_read(const uint16 addr, const ubyte high, ubyte *buf)
 {
-    ubyte ctl, ah, al;
-
-    // 1. Set control byte (high or low block):
-    ctl = I2C_EEPROM_ADDR | (high ? I2C_24LC1026_HIGH_BLK : I2C_24LC1026_LOW_BLK);
-    al = addr & 0xff;
-    ah = addr >> 8;
-
-    // 2. Read the byte from the specified block and address:
-    i2c_start();
-    if (!i2c_write(ctl | I2C_WRITE)) { return FALSE; }
-    if (!i2c_write(ah)) { return FALSE; }
-    if (!i2c_write(al)) { return FALSE; }
-    i2c_restart();
-    if (!i2c_write(ctl | I2C_READ)) { return FALSE; }
-    if (!i2c_read(buf)) { return FALSE; }
-    i2c_nack();
-    i2c_stop();
-    return TRUE;
+    return i2c_eeprom_sequence_read(addr, high, buf, 1);
 }
 
 /**
@@ -250,47 +432,93 @@ ubyte i2c_eeprom_random_read(const uint16 addr, const ubyte high, ubyte *buf)
  */
 ubyte i2c_eeprom_sequence_read(const uint16 addr, const ubyte high, ubyte *buf, uint16 len)
 {
-    uint16 i;
-    ubyte ctl, ah, al, temp;
-
-    // 1. Set control byte (high or low block):
-    ctl = I2C_EEPROM_ADDR | (high ? I2C_24LC1026_HIGH_BLK : I2C_24LC1026_LOW_BLK);
-    al = addr & 0xff;
-    ah = addr >> 8;
-
-    // 2. Generate the start signal and signal a read:
-    i2c_start();
-    if (!i2c_write(ctl | I2C_WRITE)) { return FALSE; }
-    if (!i2c_write(ah)) { return FALSE; }
-    if (!i2c_write(al)) { return FALSE; }
-    i2c_restart();
-    if (!i2c_write(ctl | I2C_READ)) { return FALSE; }
-
-    // 3. Keep ACKing the read bytes until the length - 1 byte:
-    for (i = 0; i < (len - 1); i++) {
-        if (!i2c_read(&temp)) { return FALSE; }
-        buf[i] = temp;
-        i2c_ack();
-    }
+    i2c_txn t;
 
-    // 4. Read the final byte and end with a NACK:
-    if (!i2c_read(&temp)) { return FALSE; }
-    buf[len - 1] = temp;
-    i2c_nack();
-    i2c_stop();
-    return TRUE;
+    eeprom_txn(&t, addr, high);
+    t.rbuf = buf;
+    t.rlen = len;
+    return (i2c_transfer(&t, I2C_TIMEOUT_MS) == I2C_OK);
 }
 
 /**
  * Ack polling: poll the EEPROM during its write cycle, return when it's done.
- * @param control The control byte used during the previous write (must match).
+ * @param ctl The control byte used during the previous write (must match).
+ * @return True iff the EEPROM acknowledged before the deadline
+ */
+ubyte i2c_eeprom_ack_polling(ubyte ctl)
+{
+    i2c_txn t;
+
+    eeprom_txn(&t, 0, FALSE);
+    t.addr = ctl & 0xFE;
+    t.reg_len = 0;
+    return (i2c_transfer(&t, I2C_TIMEOUT_MS) == I2C_OK);
+}
+
+
+/**
+ * Write any number of bytes anywhere in the EEPROM (00000h - 1FFFFh). The data is split into page
+ * writes at page (and so block) boundaries. Two page writes are queued at a time, so the next one
+ * is on the bus, acknowledge polling the write cycle of the previous one, as soon as that cycle
+ * ends. The last write cycle goes on in the background.
+ * @param addr 17-bit address to start at
+ * @param buf Data to write, it may be changed once the call returns
+ * @param len Number of bytes to write
+ * @return True iff all of the data was written
+ */
+ubyte i2c_eeprom_write(uint24 addr, const ubyte *buf, uint16 len)
+{
+    i2c_txn t[2];
+    ubyte i = 0, ok = TRUE;
+    uint16 n;
+
+    if (addr + len > I2C_24LC1026_SIZE) { return FALSE; }
+
+    t[0].status = I2C_OK;
+    t[1].status = I2C_OK;
+    while (len > 0) {
+        if (i2c_wait(&t[i]) != I2C_OK) {    // The page write before the previous one
+            ok = FALSE;
+            break;
+        }
+
+        n = I2C_24LC1026_PAGE_SIZE - (ubyte)(addr % I2C_24LC1026_PAGE_SIZE);
+        if (n > len) { n = len; }
+        eeprom_txn(&t[i], (uint16)addr, addr >= I2C_24LC1026_BLOCK_SIZE);
+        t[i].wbuf = buf;
+        t[i].wlen = n;
+        i2c_submit(&t[i], I2C_TIMEOUT_MS);
+
+        addr += n;
+        buf += n;
+        len -= n;
+        i ^= 1;
+    }
+    if (i2c_wait(&t[0]) != I2C_OK) { ok = FALSE; }
+    if (i2c_wait(&t[1]) != I2C_OK) { ok = FALSE; }
+    return ok;
+}
+
+/**
+ * Read any number of bytes from anywhere in the EEPROM (00000h - 1FFFFh), with one sequential
+ * read per block.
+ * @param addr 17-bit address to start at
+ * @param buf Buffer to put the data into
+ * @param len Number of bytes to read
+ * @return True iff all of the data was read
  */
-void i2c_eeprom_ack_polling(ubyte ctl)
+ubyte i2c_eeprom_read(uint24 addr, ubyte *buf, uint16 len)
 {
-    ubyte write_done = FALSE;
+    uint16 n;
 
-    while (write_done == FALSE) {
-        i2c_start();
-        write_done = i2c_write(ctl);
+    if (addr + len > I2C_24LC1026_SIZE) { return FALSE; }
+
+    while (len > 0) {
+        n = (addr < I2C_24LC1026_BLOCK_SIZE && addr + len > I2C_24LC1026_BLOCK_SIZE) ? (uint16)(I2C_24LC1026_BLOCK_SIZE - addr) : len;
+        if (!i2c_eeprom_sequence_read((uint16)addr, addr >= I2C_24LC1026_BLOCK_SIZE, buf, n)) { return FALSE; }
+        addr += n;
+        buf += n;
+        len -= n;
     }
+    return TRUE;
 }
@@ -31,26 +31,70 @@ extern "C" {
 #define I2C_24LC1026_HIGH_BLK   0x02    // The B0 bit of the address, selects between the lower or higher 512K block
 #define I2C_24LC1026_PAGE_SIZE  128     // The page size for the 24LC1026 is 128 bytes
 #define I2C_24LC1026_BLOCK_SIZE 65536   // See documentation (the 128K x 8 bit array is split into two block of 65K x 8 each)
+#define I2C_24LC1026_SIZE       ((uint24)I2C_24LC1026_BLOCK_SIZE * 2)
+
+// Bus speed profiles. Every device on the bus supports fast mode:
+#define I2C_SPEED_100KHZ        0       // Standard mode, slew rate control disabled
+#define I2C_SPEED_400KHZ        1       // Fast mode, slew rate control enabled
+#define I2C_SPEEDS              2
+#define I2C_EEPROM_SPEED        I2C_SPEED_400KHZ
+#define I2C_BMP180_SPEED        I2C_SPEED_400KHZ
+#define I2C_DS3231_SPEED        I2C_SPEED_400KHZ
+
+// Transaction status codes:
+#define I2C_OK                  0       // Completed
+#define I2C_PENDING             1       // Queued or in progress
+#define I2C_ERR_NACK            2       // The device did not acknowledge its address or a byte
+#define I2C_ERR_COLLISION       3       // Bus collision (SDA held low by another device)
+#define I2C_ERR_TIMEOUT         4       // Not completed before the deadline, the bus was reset
+
+// Transaction flags:
+#define I2C_FLAG_POLL           0x01    // Retry while the device NACKs its address (EEPROM write cycle)
+
+#define I2C_QUEUE_SIZE          4       // Transactions queued at most, i2c_submit() waits for a free slot
+#define I2C_MAX_POLLS           1000    // Address NACKs tolerated by I2C_FLAG_POLL (30 ms or more at 400 kHz)
+#define I2C_TIMEOUT_MS          50      // Deadline of a transaction: a full page write cycle takes 5 ms at most
+
+/**
+ * An I2C transaction: write the register (or memory address) bytes followed by the write data,
+ * then, after a repeated start, read the read data. Each of the three parts may be empty. The
+ * transaction and its buffers must stay in place until the status is no longer I2C_PENDING.
+ */
+typedef struct {
+    ubyte           addr;           // Address (or control byte) of the device, R/W bit clear
+    ubyte           flags;          // I2C_FLAG_*
+    ubyte           reg[2];         // Register or memory address, MSB first
+    ubyte           reg_len;        // Number of bytes in reg (0 - 2)
+    const ubyte     *wbuf;          // Data to write after the register
+    uint16          wlen;
+    ubyte           *rbuf;          // Buffer for the data read
+    uint16          rlen;
+    uint16          deadline;       // Timeout (ms) set by i2c_submit(), the ms tick by which the transaction
+                                    // must be done once it is on the bus
+    volatile ubyte  status;         // I2C_PENDING, then I2C_OK or an error code
+} i2c_txn;
+
+// Global variables:
+extern ubyte global_i2c_error;      // Status of the last transaction that failed
+extern uint16 global_i2c_errors;    // Number of failed transactions
 
 // Prototypes:
 void    init_i2c(void);
 void    close_i2c(void);
-
-void    i2c_idle( void );
-void    i2c_ack(void);
-void    i2c_nack(void);
-void    i2c_start(void);
-void    i2c_restart(void);
-void    i2c_stop(void);
-ubyte   i2c_write(const ubyte data);
-ubyte   i2c_read(ubyte *buf);
+void    i2c_set_speed(ubyte addr, ubyte speed);
+void    i2c_submit(i2c_txn *t, uint16 timeout_ms);
+ubyte   i2c_wait(i2c_txn *t);
+ubyte   i2c_transfer(i2c_txn *t, uint16 timeout_ms);
+void    i2c_isr(void);
 
 // EEPROM function prototypes:
 ubyte   i2c_eeprom_byte_write   (const uint16 addr, const ubyte high, const ubyte data);
 ubyte   i2c_eeprom_page_write   (const uint16 addr, const ubyte high, const ubyte *buf, uint16 len, ubyte ack_poll);
 ubyte   i2c_eeprom_random_read  (const uint16 addr, const ubyte high, ubyte *buf);
 ubyte   i2c_eeprom_sequence_read(const uint16 addr, const ubyte high, ubyte *buf, uint16 len);
-void    i2c_eeprom_ack_polling(ubyte ctl);
+ubyte   i2c_eeprom_ack_polling(ubyte ctl);
+ubyte   i2c_eeprom_write(uint24 addr, const ubyte *buf, uint16 len);
+ubyte   i2c_eeprom_read (uint24 addr, ubyte *buf, uint16 len);
 
 #ifdef	__cplusplus
 }
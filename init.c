@@ -11,9 +11,12 @@
 
 #include "serial.h"
 #include "gsm.h"
+#include "gps.h"
 #include "radio.h"
 #include "storage.h"
+#include "events.h"
 #include "i2c.h"
+#include "util.h"
 #include "analog_pressure.h"
 #include "digital_pressure.h"
 #include "temperature.h"
@@ -27,6 +30,13 @@ static void init_ports(void);
 
 void init(void)
 {
+    ubyte cold, wdt;
+
+    // A power-on reset leaves RAM undefined, a watchdog or software reset does not:
+    cold = (RCONbits.NOT_POR == 0) ? TRUE: FALSE;
+    wdt = (RCONbits.NOT_TO == 0) ? TRUE: FALSE;
+    RCONbits.NOT_POR = SET;
+
     // Initialize interrupts
     INTCONbits.GIE = SET;   // Enable global interrupts
     INTCONbits.PEIE = SET;  // Enable peripheral interrupts
@@ -38,16 +48,21 @@ void init(void)
     // Initialize serial communication & make sure COM SEL0 and COM SEL1 are pulled up:
     init_serial();
     printf("\r\nDaedalus Flight Controller  -  Version 1.0 (c) 2018, MA Hartman\r\n");
+    init_ticks();
     init_i2c();
 
-    // Initialize sensors:
-    if (!init_gsm()) { return; }
-    if (!init_radio()) { return; }
-    if (!init_bmp180_pressure()) { return; }
-    if (!init_temperature()) { return; }
+    // Initialize storage and retrieve last saved configuration first, so the event journal can
+    // record the failure of any of the other subsystems. Without it a failure is only noted, and
+    // logged by the first cycle that gets past init_events():
+    if (!init_storage(cold)) { event_init_failed(INIT_FAIL_STORAGE); return; }
+    if (!init_events(cold, wdt)) { event_init_failed(INIT_FAIL_EVENTS); return; }
+    init_gps(cold);
 
-    // Initialize storage and retrieve last saved configuration:
-    if (!init_storage()) { return; }
+    // Initialize sensors:
+    if (!init_gsm()) { event_init_failed(INIT_FAIL_GSM); return; }
+    if (!init_radio()) { event_init_failed(INIT_FAIL_RADIO); return; }
+    if (!init_bmp180_pressure()) { event_init_failed(INIT_FAIL_BMP180); return; }
+    if (!init_temperature()) { event_init_failed(INIT_FAIL_TEMP); return; }
 
     printf("OK\r\n");
 }
@@ -13,6 +13,7 @@
 #include "command.h"
 #include "util.h"
 #include "storage.h"
+#include "events.h"
 #include "serial.h"
 #include "digital_pressure.h"
 #include "temperature.h"
@@ -43,7 +44,10 @@ void main(void) {
         if (data_rdy_uart()) {
             if (getc_uart() == 'c') {
                 global_config.ru.config.mode = MODE_COMMAND;
-                save_record(0, &global_config);
+                event_log(EVENT_MODE, MODE_COMMAND);
+                flush_events();
+                flush_records();
+                save_config();
                 Reset();
             }
         }
@@ -51,6 +55,7 @@ void main(void) {
 
     // Otherwise run the flight routine:
     flight_control();
+    event_cycle_done();
 
     // Perform NOP's for the rest of the routine (watchdog will wake up CPU and start main() again).
     // Somehow a Sleep instruction reset the WDT and doubles the time (30 sec for flight routine, 33 sec WDT again)
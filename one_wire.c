@@ -41,11 +41,15 @@ ubyte read_OW(void)
 }
 
 
-// Initialization sequence start with reset pulse. This code generates reset sequence as per the protocol
+// Initialization sequence start with reset pulse. This code generates reset sequence as per the protocol.
+// Interrupts (the millisecond tick, I2C) are held off during the time slots of this and the functions
+// below, since an interrupt would stretch them beyond the windows of the protocol. The longest one
+// takes less than a millisecond, so no tick is lost: it is serviced right after the slot.
 ubyte OW_reset_pulse(void)
 {
     ubyte presence_detect = HIGH;   // High means no presence detected
 
+    di();
     drive_OW_low(); 				// Drive the bus low...
     __delay_us(480);                            // ... for 480 microseconds (us)
     drive_OW_high();  				// ... and release the bus
@@ -53,6 +57,7 @@ ubyte OW_reset_pulse(void)
     presence_detect = read_OW();	        // Sample for presence pulse (pulled low) from slave
     __delay_us(410);                            // Delay 410 microsecond (us)
     drive_OW_high();		    	        // Release the bus
+    ei();
 
     return presence_detect;
 }
@@ -61,6 +66,7 @@ ubyte OW_reset_pulse(void)
 // This function used to transmit a single bit to slave device.
 void OW_write_bit(ubyte write_bit)
 {
+    di();
     if (write_bit) {
         //writing a bit '1'
         drive_OW_low(); 		// Drive the bus low
@@ -75,6 +81,7 @@ void OW_write_bit(ubyte write_bit)
         drive_OW_high();  		// Release the bus
         __delay_us(10);                 // delay 10 microsecond for recovery (us)
     }
+    ei();
 }
 
 
@@ -84,14 +91,18 @@ ubyte OW_read_bit(void)
     ubyte read_data;
 
     //reading a bit
+    di();
     drive_OW_low();                     // Drive the bus low
     __delay_us(6);			// delay 6 microsecond (us) Tinit timing
     drive_OW_high ();  			// Release the bus
-    __delay_us(9);			// delay 9 microsecond (us) Trc timing
+    __delay_us(7);			// delay 7 microsecond (us) Trc timing: the calls around it take
+                                        // about 2 us at 20 MHz, so the sample is taken 15 us after the
+                                        // start of the slot, before the slave releases the bus
 
     read_data = read_OW();		//Read the status of OW_PIN
 
     __delay_us(55);			// delay 55 microsecond (us)
+    ei();
     return read_data;
 }
 
@@ -122,6 +133,23 @@ ubyte OW_read_byte(void)
 }
 
 
+// Compute the Dallas/Maxim CRC-8 (polynomial x^8 + x^5 + x^4 + 1) of a block, LS-bit first. The
+// CRC over a block that ends with its own CRC byte is zero.
+ubyte OW_crc8(const ubyte *buf, ubyte len)
+{
+    ubyte crc = 0, i, b;
+
+    while (len--) {
+        b = *buf++;
+        for (i = 0; i < 8; i++) {
+            crc = ((crc ^ b) & 0x01) ? (crc >> 1) ^ 0x8c : crc >> 1;
+            b >>= 1;
+        }
+    }
+    return crc;
+}
+
+
 // Check the presence of slave device.
 ubyte OW_detect_slave(void)
 {
@@ -32,6 +32,7 @@ extern "C" {
 #define OW_COPY_SCRATCHPAD      0x48
 #define OW_RECALL               0xb8
 #define OW_POWER_SUPPLY         0xb4
+#define OW_SCRATCHPAD_LEN       9           // Scratchpad bytes, the last one is the CRC of the others
 
 // Prototypes
 void    drive_OW_low(void);
@@ -43,6 +44,7 @@ ubyte   OW_reset_pulse(void);
 void    OW_write_byte(ubyte write_data);
 ubyte   OW_read_byte(void);
 ubyte   OW_detect_slave(void);
+ubyte   OW_crc8(const ubyte *buf, ubyte len);
 
 
 #ifdef	__cplusplus
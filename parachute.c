@@ -10,6 +10,7 @@
 #include "parachute.h"
 #include "record.h"
 #include "storage.h"
+#include "events.h"
 #include "util.h"
 
 void deploy_parachute(void)
@@ -28,5 +29,7 @@ void deploy_parachute(void)
 	global_config.status.chute_deployed = 1;
     
     // Make sure it gets saved in the EEPROM:
-    save_record(0, &global_config);
+    event_log(EVENT_PARACHUTE, 0);
+    flush_events();
+    save_config();
 }
@@ -8,6 +8,8 @@
  */
 
 #include "radio.h"
+#include "geo.h"
+#include "util.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -15,7 +17,6 @@
 
 static void rtty_send_byte(ubyte b, ubyte invert);
 static uint16 crc16_checksum(ubyte *string);
-static uint16 _crc_xmodem_update (uint16 crc, ubyte data);
 
 
 
@@ -137,30 +138,10 @@ void send_record(record *rec)
     
     enable_radio(global_config.ru.config.radio_invert);
 
-    lat[0] = rec->ru.telemetry.latitude[0];
-    lat[1] = rec->ru.telemetry.latitude[1];
-    lat[2] = ' ';
-    lat[3] = rec->ru.telemetry.latitude[2];
-    lat[4] = rec->ru.telemetry.latitude[3];
-    lat[5] = '.';
-    lat[6] = rec->ru.telemetry.latitude[4];
-    lat[7] = rec->ru.telemetry.latitude[5];
-    lat[8] = rec->ru.telemetry.latitude[6];
-    lat[9] = rec->ru.telemetry.latitude[7];
-    lat[10] = (rec->ru.telemetry.status2.north_hemi == 1) ? 'N': 'S';
-    
-    lon[0] = rec->ru.telemetry.longitude[0];
-    lon[1] = rec->ru.telemetry.longitude[1];
-    lon[2] = rec->ru.telemetry.longitude[2];
-    lon[3] = ' ';
-    lon[4] = rec->ru.telemetry.longitude[3];
-    lon[5] = rec->ru.telemetry.longitude[4];
-    lon[6] = '.';
-    lon[7] = rec->ru.telemetry.longitude[5];
-    lon[8] = rec->ru.telemetry.longitude[6];
-    lon[9] = rec->ru.telemetry.longitude[7];
-    lon[10] = rec->ru.telemetry.longitude[8];
-    lon[11] = (rec->ru.telemetry.status2.east_hemi == 1) ? 'E': 'W';
+    geo_ddmm(rec->ru.telemetry.latitude, 2, ' ', lat);
+    lat[10] = (rec->ru.telemetry.latitude >= 0) ? 'N': 'S';
+    geo_ddmm(rec->ru.telemetry.longitude, 3, ' ', lon);
+    lon[11] = (rec->ru.telemetry.longitude >= 0) ? 'E': 'W';
     
     pf24bfix = (sint32)rec->ru.telemetry.alt_gps;
     sprintf(tele, "  MHAB%u %u%u %ldm ", \
@@ -209,42 +190,17 @@ void send_record(record *rec)
     sprintf(buf, "%02u:%02u:%02u,", rec->ru.telemetry.hours, rec->ru.telemetry.minutes, rec->ru.telemetry.seconds);
     strcat(out, buf);
     
-    // Latitude
-    memset(buf, '\0', sizeof(buf));
+    // Latitude and longitude:
     i = 0;
-    if (!rec->ru.telemetry.status2.north_hemi) { // southern hemisphere
-        buf[i++] = '-';
-    }
-    buf[i++] = rec->ru.telemetry.latitude[0]; // D
-    buf[i++] = rec->ru.telemetry.latitude[1]; // D
-    buf[i++] = rec->ru.telemetry.latitude[2]; // m
-    buf[i++] = rec->ru.telemetry.latitude[3]; // m
-    buf[i++] = '.';                           // .
-    buf[i++] = rec->ru.telemetry.latitude[4]; // m
-    buf[i++] = rec->ru.telemetry.latitude[5]; // m
-    buf[i++] = rec->ru.telemetry.latitude[6]; // m
-    buf[i++] = rec->ru.telemetry.latitude[7]; // m
-    buf[i++] = ',';
+    if (rec->ru.telemetry.latitude < 0) { buf[i++] = '-'; }     // Southern hemisphere
+    geo_ddmm(rec->ru.telemetry.latitude, 2, 0, buf + i);
     strcat(out, buf);
-    
-    // Longitude
-    memset(buf, '\0', sizeof(buf));
+    strcat(out, ",");
     i = 0;
-    if (!rec->ru.telemetry.status2.east_hemi) { // western hemisphere
-        buf[i++] = '-';
-    }
-    buf[i++] = rec->ru.telemetry.longitude[0]; // D
-    buf[i++] = rec->ru.telemetry.longitude[1]; // D
-    buf[i++] = rec->ru.telemetry.longitude[2]; // D
-    buf[i++] = rec->ru.telemetry.longitude[3]; // m
-    buf[i++] = rec->ru.telemetry.longitude[4]; // m
-    buf[i++] = '.';                           // .
-    buf[i++] = rec->ru.telemetry.longitude[5]; // m
-    buf[i++] = rec->ru.telemetry.longitude[6]; // m
-    buf[i++] = rec->ru.telemetry.longitude[7]; // m
-    buf[i++] = rec->ru.telemetry.longitude[8]; // m
-    buf[i++] = ',';
+    if (rec->ru.telemetry.longitude < 0) { buf[i++] = '-'; }    // Western hemisphere
+    geo_ddmm(rec->ru.telemetry.longitude, 3, 0, buf + i);
     strcat(out, buf);
+    strcat(out, ",");
     
     // Altitude
     pf24bfix = (sint32)rec->ru.telemetry.alt_gps;
@@ -293,26 +249,9 @@ static uint16 crc16_checksum(ubyte *string)
 	// Calculate checksum ignoring the first four $s
 	for (i = 4; i < strlen(string); i++) {
 		c = string[i];
-		crc = _crc_xmodem_update(crc, c);
+		crc = crc16_update(crc, c);
 	}
  
 	return crc;
 }
 
-
-static uint16 _crc_xmodem_update (uint16 crc, ubyte data)
-{
-    ubyte i;
-    
-    crc = crc ^ ((uint16)data << 8);
-    
-    for (i = 0; i < 8; i++) {
-        if (crc & 0x8000) {
-            crc = (crc << 1) ^ 0x1021;
-        } else {
-            crc <<= 1;
-        }
-    }
-    
-    return crc;
-}
@@ -7,9 +7,54 @@
 
 #include "record.h"
 
+#include "geo.h"
 #include "serial.h"
+#include "util.h"
 
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <stddef.h>
+
+
+// Bit positions and widths of the fields in record_v2.packed:
+#define V2_TIME_POS     0
+#define V2_TIME_BITS    20
+#define V2_LAT_POS      20
+#define V2_LAT_BITS     25
+#define V2_LON_POS      45
+#define V2_LON_BITS     26
+#define V2_PRES_POS     71
+#define V2_PRES_BITS    17
+
+// A telemetry record never has the config flag set, so its bit in record_v2.status_byte carries
+// status2.gps_stale instead (there is no spare bit in record_v2.packed):
+#define V2_STATUS_STALE 0x80
+
+// Each delta is coded as '0' (zero), '10' followed by a small or '11' followed by a large two's
+// complement value. Time, position, altitude and pressure change at a steady rate, so for those
+// fields the change of the difference is coded (second order). The status is '0' if unchanged,
+// otherwise '1' followed by the new status byte.
+#define DELTA_SECOND_ORDER  V2_FIELD_TEMP_IN    // Fields before this one are coded second order
+#define DELTA_KEY(page)     ((record_v2 *)(page)->body)
+#define DELTA_STREAM(page)  ((page)->body + sizeof(record_v2))
+#define DELTA_BITS          ((sizeof(((log_page *)0)->body) - sizeof(record_v2)) * 8)
+
+// Size of a record and its CRC in a page of RECORD_V1 or RECORD_V2 records:
+#define RECORD_SIZE(format) (((format) == RECORD_V1) ? sizeof(record) : sizeof(record_v2))
+#define SLOT_SIZE(format)   (RECORD_SIZE(format) + sizeof(uint16))
+#define SLOTS(format)       (sizeof(((log_page *)0)->body) / SLOT_SIZE(format))
+static const ubyte delta_small[V2_FIELDS] = {3, 8, 8, 8, 8, 3, 3, 0};
+static const ubyte delta_large[V2_FIELDS] = {22, 27, 28, 18, 19, 9, 9, 0};
+
+static ubyte delta_append(log_page *page, record *rec);
+static void put_slot(log_page *page, record *rec);
+static uint16 slot_crc(uint16 num, ubyte *slot, ubyte size);
+static uint16 page_crc(log_page *page);
+static uint16 delta_state(log_page *page, ubyte n, sint32 *val, sint32 *dif);
+static uint16 delta_put(ubyte *buf, uint16 pos, ubyte field, sint32 value);
+static sint32 coord_e5(sint32 e6);
+static sint16 sign_extend12(uint16 value);
 
 
 /**
@@ -18,7 +63,7 @@
  */
 void print_record(record *rec)
 {
-    ubyte i;
+    ubyte coord[GEO_DDMM_SIZE];
     sint16 temp_in, temp_ex;
     uint24 temp;
     sint32 pf24bfix;
@@ -45,25 +90,13 @@ void print_record(record *rec)
     temp_ex = ((sint16)(temp >> 12)) / 16;
     printf("\"temp_in\": %d, \"temp_ex\": %d,\r\n", temp_in, temp_ex);
     printf("\"pressure\": \"%lu Pa\", ", rec->ru.telemetry.pressure);
-    printf("\"baro digital\": %u,\r\n", rec->ru.telemetry.status2.baro_digi);
+    printf("\"baro digital\": %u, ", rec->ru.telemetry.status2.baro_digi);
+    printf("\"gps stale\": %u,\r\n", rec->ru.telemetry.status2.gps_stale);
 
-    printf("\"position\": { \"lat\": \"");
-    for (i = 0; i < 8; i++) {
-        if (i == 2) { putch(' '); }     // Put a space after the degrees (dd mm.mmmm output format)
-        if (i == 4) { putch('.'); }     // Put a dot after the first two minute decimals
-        putch(rec->ru.telemetry.latitude[i]);
-    }
-    if (rec->ru.telemetry.status2.north_hemi == 1) { printf(" N"); }
-    else { printf(" S"); }
-    printf("\", \"lon\": \"");
-
-    for (i = 0; i < 9; i++) {
-        if (i == 3) { putch(' '); }     // Put a space after the degrees (ddd mm.mmmm output format)
-        if (i == 5) { putch('.'); }     // Put a dot after the first two minute decimals
-        putch(rec->ru.telemetry.longitude[i]);
-    }
-    if (rec->ru.telemetry.status2.east_hemi == 1) { printf(" E"); }
-    else { printf(" W"); }
+    geo_ddmm(rec->ru.telemetry.latitude, 2, ' ', coord);
+    printf("\"position\": { \"lat\": \"%s %c", coord, (rec->ru.telemetry.latitude >= 0) ? 'N' : 'S');
+    geo_ddmm(rec->ru.telemetry.longitude, 3, ' ', coord);
+    printf("\", \"lon\": \"%s %c", coord, (rec->ru.telemetry.longitude >= 0) ? 'E' : 'W');
     printf("\" },\r\n");
 
     pf24bfix = (sint32)rec->ru.telemetry.alt_gps;   // Printf routine does not handle 24 bit types well
@@ -71,3 +104,399 @@ void print_record(record *rec)
     
     printf("}\r\n");
 }
+
+
+/**
+ * Time of a telemetry record.
+ * @return Seconds since 00:00 UTC on the launch day
+ */
+uint32 record_time(record *rec)
+{
+    return (uint32)rec->ru.telemetry.days * 86400 + (uint32)rec->ru.telemetry.hours * 3600 + \
+        (uint16)rec->ru.telemetry.minutes * 60 + rec->ru.telemetry.seconds;
+}
+
+
+/**
+ * Pack a telemetry record into the RECORD_V2 format.
+ * @param rec The record to pack
+ * @param v2 The packed record
+ */
+void pack_record_v2(record *rec, record_v2 *v2)
+{
+    uint32 t;
+    sint32 alt;
+    uint24 temp;
+
+    memset(v2, '\0', sizeof(record_v2));
+    v2->status_byte = rec->status.status_byte & ~V2_STATUS_STALE;
+    if (rec->ru.telemetry.status2.gps_stale) { v2->status_byte |= V2_STATUS_STALE; }
+
+    // Temperatures in whole degrees (raw units are 0.1C internal and 1/16C external):
+    temp = rec->ru.telemetry.temperature;
+    v2->temp_in = (sbyte)(sign_extend12((uint16)(temp & 0x000fff)) / 10);
+    v2->temp_ex = (sbyte)(sign_extend12((uint16)(temp >> 12)) / 16);
+
+    alt = (sint32)rec->ru.telemetry.alt_gps + V2_ALT_OFFSET;
+    if (alt < 0) { alt = 0; }
+    else if (alt > USHRT_MAX) { alt = USHRT_MAX; }
+    v2->alt_gps = (uint16)alt;
+
+    // 20 bits hold 12 days and 3 hours; a flight longer than that sticks at the last second:
+    t = record_time(rec);
+    if (t >= ((uint32)1 << V2_TIME_BITS)) { t = ((uint32)1 << V2_TIME_BITS) - 1; }
+    put_bits(v2->packed, V2_TIME_POS, V2_TIME_BITS, t);
+
+    put_bits(v2->packed, V2_LAT_POS, V2_LAT_BITS, (uint32)coord_e5(rec->ru.telemetry.latitude));
+    put_bits(v2->packed, V2_LON_POS, V2_LON_BITS, (uint32)coord_e5(rec->ru.telemetry.longitude));
+
+    t = rec->ru.telemetry.pressure;
+    if (t >= ((uint32)1 << V2_PRES_BITS)) { t = ((uint32)1 << V2_PRES_BITS) - 1; }
+    put_bits(v2->packed, V2_PRES_POS, V2_PRES_BITS, t);
+}
+
+
+/**
+ * Unpack a RECORD_V2 record into a telemetry record.
+ * @param v2 The packed record
+ * @param rec The unpacked record
+ */
+void unpack_record_v2(record_v2 *v2, record *rec)
+{
+    uint32 t;
+
+    memset(rec, '\0', sizeof(record));
+    rec->status.status_byte = v2->status_byte & ~V2_STATUS_STALE;
+    rec->ru.telemetry.temperature = ((((uint24)(v2->temp_ex * 16)) & 0x000fff) << 12) | \
+                                    (((uint24)(v2->temp_in * 10)) & 0x000fff);
+    rec->ru.telemetry.alt_gps = (sint24)v2->alt_gps - V2_ALT_OFFSET;
+
+    t = get_bits(v2->packed, V2_TIME_POS, V2_TIME_BITS);
+    rec->ru.telemetry.days = (ubyte)(t / 86400);
+    t %= 86400;
+    rec->ru.telemetry.hours = (ubyte)(t / 3600);
+    t %= 3600;
+    rec->ru.telemetry.minutes = (ubyte)(t / 60);
+    rec->ru.telemetry.seconds = (ubyte)(t % 60);
+
+    rec->ru.telemetry.status2.baro_digi = 1;
+    rec->ru.telemetry.status2.gps_stale = (v2->status_byte & V2_STATUS_STALE) ? 1 : 0;
+    rec->ru.telemetry.latitude = get_sbits(v2->packed, V2_LAT_POS, V2_LAT_BITS) * 10;
+    rec->ru.telemetry.longitude = get_sbits(v2->packed, V2_LON_POS, V2_LON_BITS) * 10;
+
+    rec->ru.telemetry.pressure = (uint24)get_bits(v2->packed, V2_PRES_POS, V2_PRES_BITS);
+}
+
+
+/**
+ * Retrieve the fields of a packed record as integers (V2_FIELD_TIME ... V2_FIELD_STATUS).
+ * @param v2 The packed record
+ * @param fields Array of V2_FIELDS integers
+ */
+void record_v2_fields(record_v2 *v2, sint32 *fields)
+{
+    fields[V2_FIELD_TIME] =     (sint32)get_bits(v2->packed, V2_TIME_POS, V2_TIME_BITS);
+    fields[V2_FIELD_LAT] =      get_sbits(v2->packed, V2_LAT_POS, V2_LAT_BITS);
+    fields[V2_FIELD_LON] =      get_sbits(v2->packed, V2_LON_POS, V2_LON_BITS);
+    fields[V2_FIELD_ALT] =      (sint32)v2->alt_gps;
+    fields[V2_FIELD_PRESSURE] = (sint32)get_bits(v2->packed, V2_PRES_POS, V2_PRES_BITS);
+    fields[V2_FIELD_TEMP_IN] =  (sint32)v2->temp_in;
+    fields[V2_FIELD_TEMP_EX] =  (sint32)v2->temp_ex;
+    fields[V2_FIELD_STATUS] =   (sint32)v2->status_byte;
+}
+
+
+/**
+ * Set the fields of a packed record from integers.
+ * @param fields Array of V2_FIELDS integers
+ * @param v2 The packed record
+ */
+void record_v2_set_fields(sint32 *fields, record_v2 *v2)
+{
+    put_bits(v2->packed, V2_TIME_POS, V2_TIME_BITS, (uint32)fields[V2_FIELD_TIME]);
+    put_bits(v2->packed, V2_LAT_POS,  V2_LAT_BITS,  (uint32)fields[V2_FIELD_LAT]);
+    put_bits(v2->packed, V2_LON_POS,  V2_LON_BITS,  (uint32)fields[V2_FIELD_LON]);
+    v2->alt_gps =     (uint16)fields[V2_FIELD_ALT];
+    put_bits(v2->packed, V2_PRES_POS, V2_PRES_BITS, (uint32)fields[V2_FIELD_PRESSURE]);
+    v2->temp_in =     (sbyte)fields[V2_FIELD_TEMP_IN];
+    v2->temp_ex =     (sbyte)fields[V2_FIELD_TEMP_EX];
+    v2->status_byte = (ubyte)fields[V2_FIELD_STATUS];
+}
+
+
+/**
+ * Start a log page with the given record as its first record.
+ * @param page The page
+ * @param format Format of the records (RECORD_V1, RECORD_V2 or RECORD_DELTA)
+ * @param flight Flight number the page belongs to
+ * @param num Sequence number of the record
+ * @param rec The record
+ */
+void log_page_start(log_page *page, ubyte format, ubyte flight, uint16 num, record *rec)
+{
+    memset(page, '\0', sizeof(log_page));
+    page->first = num;
+    page->format = format;
+    page->flight = flight;
+    if (format == RECORD_DELTA) {
+        pack_record_v2(rec, DELTA_KEY(page));
+        page->count = 1;
+    }
+    else { put_slot(page, rec); }
+    page->crc = page_crc(page);
+}
+
+
+/**
+ * Append a record (numbered page->first + page->count) to a log page.
+ * @param page The page
+ * @param rec The record
+ * @return True iff the record fit in the page
+ */
+ubyte log_page_append(log_page *page, record *rec)
+{
+    if (page->format == RECORD_DELTA) {
+        if (!delta_append(page, rec)) { return FALSE; }
+    }
+    else {
+        if (log_page_full(page)) { return FALSE; }
+        put_slot(page, rec);
+    }
+    page->crc = page_crc(page);
+    return TRUE;
+}
+
+
+/**
+ * Check whether a log page is full. A delta-compressed page is only known to be full once a record
+ * does not fit anymore, log_page_append() tells.
+ * @param page The page
+ * @return True iff no record can be appended to the page
+ */
+ubyte log_page_full(log_page *page)
+{
+    if (page->format == RECORD_DELTA) { return (page->count == UCHAR_MAX); }
+    return (page->count >= SLOTS(page->format));
+}
+
+
+/**
+ * Check whether a log page is intact: its header makes sense and its CRC matches.
+ * @param page The page
+ * @return True iff the page can be trusted
+ */
+ubyte log_page_intact(log_page *page)
+{
+    if (page->count == 0 || page->format > RECORD_DELTA) { return FALSE; }
+    if (page->format != RECORD_DELTA && page->count > SLOTS(page->format)) { return FALSE; }
+    return (page->crc == page_crc(page));
+}
+
+
+/**
+ * Decode a record from a log page.
+ * @param page The page
+ * @param num Sequence number of the record (page->first ... page->first + page->count - 1)
+ * @param rec The decoded record (untouched if the record can not be decoded)
+ * @return True iff the record is in the page and its CRC matches
+ */
+ubyte log_page_decode(log_page *page, uint16 num, record *rec)
+{
+    record_v2 v2;
+    sint32 val[V2_FIELDS], dif[V2_FIELDS];
+    ubyte *slot;
+    ubyte idx;
+
+    if (num < page->first || num - page->first >= page->count) { return FALSE; }
+    idx = (ubyte)(num - page->first);
+
+    switch (page->format) {
+        case RECORD_V1:
+        case RECORD_V2:
+            // A record with an intact CRC can be decoded even if the rest of the page is torn:
+            if (idx >= SLOTS(page->format)) { return FALSE; }
+            slot = &page->body[idx * SLOT_SIZE(page->format)];
+            if (slot_crc(num, slot, RECORD_SIZE(page->format)) != *(uint16 *)(slot + RECORD_SIZE(page->format))) { return FALSE; }
+            if (page->format == RECORD_V1) { memcpy(rec, slot, sizeof(record)); }
+            else { unpack_record_v2((record_v2 *)slot, rec); }
+            return TRUE;
+        case RECORD_DELTA:
+            if (!log_page_intact(page)) { return FALSE; }
+            delta_state(page, idx, val, dif);
+            memset(&v2, '\0', sizeof(record_v2));
+            record_v2_set_fields(val, &v2);
+            unpack_record_v2(&v2, rec);
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+
+/**
+ * Append a record to a delta-compressed page.
+ * @param page The page
+ * @param rec The record
+ * @return True iff the record fit in the page
+ */
+static ubyte delta_append(log_page *page, record *rec)
+{
+    record_v2 v2;
+    sint32 val[V2_FIELDS], dif[V2_FIELDS], cur[V2_FIELDS];
+    uint16 pos, end;
+    ubyte i;
+
+    if (page->count == UCHAR_MAX) { return FALSE; }
+
+    // Determine the previous record and the differences to code:
+    pos = delta_state(page, page->count - 1, val, dif);
+    pack_record_v2(rec, &v2);
+    record_v2_fields(&v2, cur);
+    for (i = 0; i < V2_FIELD_STATUS; i++) {
+        cur[i] -= val[i];                                   // Difference with the previous record
+        if (i < DELTA_SECOND_ORDER) { cur[i] -= dif[i]; }   // Change of the difference
+    }
+    cur[V2_FIELD_STATUS] = (cur[V2_FIELD_STATUS] == val[V2_FIELD_STATUS]) ? -1 : cur[V2_FIELD_STATUS];
+
+    // Check whether the coded record fits, then code it:
+    end = pos;
+    for (i = 0; i < V2_FIELDS; i++) { end = delta_put(NULL, end, i, cur[i]); }
+    if (end > DELTA_BITS) { return FALSE; }
+    for (i = 0; i < V2_FIELDS; i++) { pos = delta_put(DELTA_STREAM(page), pos, i, cur[i]); }
+
+    page->count++;
+    return TRUE;
+}
+
+
+/**
+ * Store a record in the next slot of a page of RECORD_V1 or RECORD_V2 records.
+ */
+static void put_slot(log_page *page, record *rec)
+{
+    ubyte *slot;
+
+    slot = &page->body[page->count * SLOT_SIZE(page->format)];
+    if (page->format == RECORD_V1) { memcpy(slot, rec, sizeof(record)); }
+    else { pack_record_v2(rec, (record_v2 *)slot); }
+    *(uint16 *)(slot + RECORD_SIZE(page->format)) = slot_crc(page->first + page->count, slot, RECORD_SIZE(page->format));
+    page->count++;
+}
+
+
+/**
+ * CRC16 over the sequence number and contents of a stored record. Including the sequence number
+ * rejects a stale record left in the slot by an earlier lap of the log ring.
+ */
+static uint16 slot_crc(uint16 num, ubyte *slot, ubyte size)
+{
+    uint16 crc;
+
+    crc = crc16_update(0xffff, (ubyte)num);
+    crc = crc16_update(crc, (ubyte)(num >> 8));
+    while (size--) { crc = crc16_update(crc, *slot++); }
+    return crc;
+}
+
+
+/**
+ * CRC16 over the header fields (except the CRC itself) and the body of a log page.
+ */
+static uint16 page_crc(log_page *page)
+{
+    uint16 crc;
+    ubyte i;
+
+    crc = crc16_block((ubyte *)page, offsetof(log_page, crc));
+    for (i = 0; i < sizeof(page->body); i++) { crc = crc16_update(crc, page->body[i]); }
+    return crc;
+}
+
+
+/**
+ * Decode the first n deltas of a delta-compressed page.
+ * @param page The page
+ * @param n Number of deltas to decode
+ * @param val The fields of record page->first + n
+ * @param dif The differences of those fields with the record before it
+ * @return Bit position of the next delta
+ */
+static uint16 delta_state(log_page *page, ubyte n, sint32 *val, sint32 *dif)
+{
+    sint32 v;
+    uint16 pos = 0;
+    ubyte i, bits;
+
+    record_v2_fields(DELTA_KEY(page), val);
+    memset(dif, '\0', V2_FIELDS * sizeof(sint32));
+
+    for (; n > 0; n--) {
+        for (i = 0; i < V2_FIELD_STATUS; i++) {
+            v = 0;
+            if (get_bits(DELTA_STREAM(page), pos++, 1)) {
+                bits = get_bits(DELTA_STREAM(page), pos++, 1) ? delta_large[i] : delta_small[i];
+                v = get_sbits(DELTA_STREAM(page), pos, bits);
+                pos += bits;
+            }
+            if (i < DELTA_SECOND_ORDER) { dif[i] += v; }
+            else { dif[i] = v; }
+            val[i] += dif[i];
+        }
+        if (get_bits(DELTA_STREAM(page), pos++, 1)) {
+            val[V2_FIELD_STATUS] = (sint32)get_bits(DELTA_STREAM(page), pos, 8);
+            pos += 8;
+        }
+    }
+    return pos;
+}
+
+
+/**
+ * Code a single field of a delta.
+ * @param buf Bit stream to code into, or NULL to only determine the length
+ * @param pos Bit position in the bit stream
+ * @param field The field (V2_FIELD_TIME ... V2_FIELD_STATUS)
+ * @param value The value to code (for V2_FIELD_STATUS: the new status, or -1 if unchanged)
+ * @return Bit position after the coded field
+ */
+static uint16 delta_put(ubyte *buf, uint16 pos, ubyte field, sint32 value)
+{
+    ubyte bits;
+
+    if (field == V2_FIELD_STATUS) {
+        if (value < 0) {
+            if (buf) { put_bits(buf, pos, 1, 0); }
+            return pos + 1;
+        }
+        if (buf) { put_bits(buf, pos, 1, 1); put_bits(buf, pos + 1, 8, (uint32)value); }
+        return pos + 9;
+    }
+
+    if (value == 0) {
+        if (buf) { put_bits(buf, pos, 1, 0); }
+        return pos + 1;
+    }
+    bits = delta_small[field];
+    if (value < -((sint32)1 << (bits - 1)) || value >= ((sint32)1 << (bits - 1))) {
+        bits = delta_large[field];
+        if (buf) { put_bits(buf, pos, 2, 3); }
+    }
+    else if (buf) { put_bits(buf, pos, 2, 2); }
+    if (buf) { put_bits(buf, pos + 2, bits, (uint32)value); }
+    return pos + 2 + bits;
+}
+
+
+/**
+ * Convert micro-degrees into 1e-5 degrees (rounded).
+ */
+static sint32 coord_e5(sint32 e6)
+{
+    return (e6 >= 0) ? (e6 + 5) / 10 : (e6 - 5) / 10;
+}
+
+
+static sint16 sign_extend12(uint16 value)
+{
+    return (value & 0x0800) ? (sint16)(value | 0xf000) : (sint16)value;
+}
@@ -17,6 +17,23 @@ extern "C" {
 #define SIZE_CELL_NUMBER    16
 #define SIZE_PHONE_PIN      4
 
+// Telemetry record formats in the EEPROM log:
+#define RECORD_V1           0       // The record struct below (32 bytes)
+#define RECORD_V2           1       // The packed record_v2 struct (16 bytes)
+#define RECORD_DELTA        2       // Pages of a record_v2 keyframe followed by bit-packed deltas
+#define V2_ALT_OFFSET       1000    // Offset of the record_v2 altitude, allows for launch sites below sea level
+
+// The fields of a record_v2 as integers (see record_v2_fields()):
+#define V2_FIELD_TIME       0       // Seconds in 20 bits: clamped at 12 days 3 hours by pack_record_v2()
+#define V2_FIELD_LAT        1
+#define V2_FIELD_LON        2
+#define V2_FIELD_ALT        3
+#define V2_FIELD_PRESSURE   4
+#define V2_FIELD_TEMP_IN    5
+#define V2_FIELD_TEMP_EX    6
+#define V2_FIELD_STATUS     7
+#define V2_FIELDS           8
+
 
 typedef struct {
                                     // Bit#      Description
@@ -24,7 +41,7 @@ typedef struct {
     union {
     struct {
     ubyte       ascending: 1;       // 00       1 when probe is ascending, 0 if probe is not
-    ubyte       moving: 1;          // 01       1 when position is different with respect to previous position
+    ubyte       moving: 1;          // 01       1 when moving (GPS speed over ground or altitude change since the previous record)
     ubyte       chute_deployed: 1;  // 02       1 if parachute is deployed, 0 if not
     ubyte       gps_lock: 1;        // 03       1 if probe has GPS lock, 0 if not
     ubyte       radio_on: 1;        // 04       1 if Radio NTX2 system is turned on, 0 if not
@@ -52,16 +69,16 @@ struct {
     union {
     struct {
     ubyte       baro_digi: 1;       // 88       1 if digital pressure, 0 if analog pressure
-    ubyte       north_hemi: 1;      // 89       1 if North, 0 if South
-    ubyte       east_hemi: 1;       // 90       1 if East, 0 if West
-    ubyte       padding: 5;         // 91 - 95  Padding bytes (zero default)
+    ubyte       gps_stale: 1;       // 89       1 if the GPS missed its deadline or sleeps: time and position are those of the last valid fix
+    ubyte       padding: 6;         // 90 - 95  Padding bytes (zero default)
     };
     ubyte       status2_byte;
     } status2;
 
-    ubyte       latitude[8];        // 96 -159  ddmm.mmmm format (excluding dot)
-    ubyte       longitude[9];       // 160-231  dddmm.mmmm format (excluding dot)
-    sint24      alt_gps;            // 232-255  GPS altitude (in meters)
+    sint32      latitude;           // 96 -127  Micro-degrees, north positive
+    sint32      longitude;          // 128-159  Micro-degrees, east positive
+    sint24      alt_gps;            // 160-183  GPS altitude (in meters)
+    ubyte       reserved[9];        // 184-255  Unused (zero)
 } telemetry;
 
 /**
@@ -69,7 +86,8 @@ struct {
  */
 struct {
     ubyte       mode;               // The mode the device was in.
-    uint16      last_altitude;      // The altitude from the last record
+    ubyte       log_format;         // Format of new telemetry records in the log (RECORD_V1, RECORD_V2 or RECORD_DELTA)
+    ubyte       flight;             // Number of the current flight, stamped into its log pages
     uint16      last_record;        // The number of the last written record
 
     ubyte       cell_number[SIZE_CELL_NUMBER];  // Space for a 16 digit cell-phone number used for the GSM (16 bytes)
@@ -89,10 +107,60 @@ struct {
 } record;   // End of record struct
 
 
+/**
+ * Packed telemetry record (RECORD_V2). Coordinates are signed fixed-point integers and the time is
+ * counted in seconds, so the record takes half the space of a record struct.
+ */
+typedef struct {
+    uint16      alt_gps;            // 00 - 15  GPS altitude (in meters) plus V2_ALT_OFFSET
+    ubyte       status_byte;        // 16 - 23  Same status flags as the record, but bit 7 is gps_stale
+    sbyte       temp_in;            // 24 - 31  Internal temperature (C)
+    sbyte       temp_ex;            // 32 - 39  External temperature (C)
+    ubyte       packed[11];         // 40 - 59  Seconds since 00:00 UTC on the launch day (20 bits)
+                                    // 60 - 84  Latitude in 1e-5 degrees, north positive (25 bits)
+                                    // 85 -110  Longitude in 1e-5 degrees, east positive (26 bits)
+                                    // 111-127  Pressure in Pa (17 bits)
+} record_v2;
+
+
+/**
+ * Page of the telemetry log. The log is a ring of these pages; each one holds consecutive records,
+ * starting with the record numbered first. Records are numbered with a sequence number that keeps
+ * increasing when the ring wraps, so the number of a record is first plus its index in the page.
+ *
+ * The body holds record structs (RECORD_V1) or record_v2 structs (RECORD_V2), each followed by a
+ * CRC16 over its sequence number and contents, or, for RECORD_DELTA, the first record as a
+ * record_v2 keyframe followed by each following record as a bit-packed difference with the one
+ * before it. Consecutive records differ little, so a delta-compressed page holds 4 - 6 times as
+ * many records as a page of record structs. A delta can only be decoded together with the records
+ * before it, so those records are protected by the CRC16 over the whole page.
+ */
+#define LOG_PAGE_SIZE       128     // One 24LC1026 page
+typedef struct {
+    uint16      first;              // Sequence number of the first record in the page
+    ubyte       count;              // Number of records in the page
+    ubyte       format;             // Format of the records (RECORD_V1, RECORD_V2 or RECORD_DELTA)
+    ubyte       flight;             // Flight number of the config when the page was started
+    ubyte       reserved;           // Unused (zero)
+    uint16      crc;                // CRC16 over the header fields above and the body
+    ubyte       body[LOG_PAGE_SIZE - 8];
+} log_page;
+
+
 // The global config is defined in the main.c file:
 extern record global_config;
 
 void print_record(record *rec);
+uint32 record_time(record *rec);
+void pack_record_v2(record *rec, record_v2 *v2);
+void unpack_record_v2(record_v2 *v2, record *rec);
+void record_v2_fields(record_v2 *v2, sint32 *fields);
+void record_v2_set_fields(sint32 *fields, record_v2 *v2);
+void log_page_start(log_page *page, ubyte format, ubyte flight, uint16 num, record *rec);
+ubyte log_page_append(log_page *page, record *rec);
+ubyte log_page_full(log_page *page);
+ubyte log_page_intact(log_page *page);
+ubyte log_page_decode(log_page *page, uint16 num, record *rec);
 
 
 #ifdef	__cplusplus
@@ -9,11 +9,18 @@
  */
 
 #include "serial.h"
+#include "i2c.h"
+#include "util.h"
 
 
 // Global variables
-volatile ubyte global_uart_buffer;  // Volatile since it will be accessed by both normal code and  ISR
-volatile ubyte global_uart_new_data;    // True iff unread data is in the uart buffer.
+volatile ubyte global_uart_rx_head;     // Number of bytes received (modulo 256)
+volatile ubyte global_uart_rx_tail;     // Number of bytes read (modulo 256)
+volatile ubyte global_uart_tx_len;      // Number of bytes of an asynchronous write still to be sent
+volatile uint16 global_uart_overflows;
+volatile uint16 global_uart_framing_errors;
+static volatile ubyte uart_rx_buf[UART_RX_SIZE];    // Received bytes, indexed by head/tail & UART_RX_MASK
+static const ubyte * volatile uart_tx_buf;  // Next byte of an asynchronous write
 
 // Function prototypes
 static void open_uart(uint16 sbrg, ubyte inversion);
@@ -85,11 +92,35 @@ void serial_channel(ubyte channel)
  */
 ubyte getc_uart(void)
 {
+    ubyte c;
+
     while (!data_rdy_uart()) { Nop(); } // Blocking wait for character to arrive
 
-    // Clear new data flag and return charactor from buffer:
-    global_uart_new_data = CLEAR;
-    return global_uart_buffer;
+    // Take the character before handing its slot back to the ISR:
+    c = uart_rx_buf[global_uart_rx_tail & UART_RX_MASK];
+    global_uart_rx_tail++;
+    return c;
+}
+
+
+/**
+ * Read the characters received so far, without waiting, so a burst can be drained at once.
+ * @param buf Buffer to read into
+ * @param n Size of the buffer
+ * @return The number of characters read (0 - n)
+ */
+ubyte read_uart(ubyte *buf, ubyte n)
+{
+    ubyte i, tail, avail;
+
+    tail = global_uart_rx_tail;
+    avail = rx_count_uart();
+    if (n > avail) { n = avail; }
+    for (i = 0; i < n; i++) {
+        buf[i] = uart_rx_buf[tail++ & UART_RX_MASK];
+    }
+    global_uart_rx_tail = tail;
+    return n;
 }
 
 
@@ -99,12 +130,31 @@ ubyte getc_uart(void)
  */
 void putch(ubyte c)
 {
+    while (tx_busy_uart()) { Nop(); }   // Wait until an asynchronous write is done
     while (!TXSTAbits.TRMT) { Nop(); }  // Wait until the TSR buffer is empty
     TXREG = c;      // Write the data byte to the USART
     while (!TXSTAbits.TRMT) { Nop(); }  // Wait until the TSR buffer is empty
 }
 
 
+/**
+ * Start sending a buffer to the UART in the background: the ISR writes each byte to the EUSART as
+ * soon as it can take it, so the caller can prepare the next buffer meanwhile. Waits until the
+ * previous asynchronous write is done, the buffer must stay untouched until tx_busy_uart() is false.
+ * @param buf The bytes to send
+ * @param len The number of bytes to send
+ */
+void write_uart(const ubyte *buf, ubyte len)
+{
+    while (tx_busy_uart()) { Nop(); }
+    if (len == 0) { return; }
+
+    uart_tx_buf = buf;
+    global_uart_tx_len = len;
+    PIE1bits.TXIE = SET;        // TXIF is set while TXREG is empty, so the ISR starts right away
+}
+
+
 /**
  * Open the EUSART properly.
  * @param sbrg Baudrate generator value
@@ -114,8 +164,8 @@ static void open_uart(uint16 sbrg, ubyte inversion)
 {
     ubyte c;
 
-    // Invalidate any data in the buffer:
-    global_uart_new_data = CLEAR;
+    // Invalidate any data in the buffer (the receive interrupt is disabled by close_uart()):
+    global_uart_rx_tail = global_uart_rx_head;
 
     RCSTA = CLEAR;              // Reset USART registers to POR state:
     TXSTA = CLEAR;
@@ -163,9 +213,10 @@ static void close_uart(void)
 
     PIE1bits.RCIE = 0;  // Disable interrupt on receive
     PIE1bits.TXIE = 0;  // Disable interrupt on transmission
+    global_uart_tx_len = 0; // Abandon an asynchronous write
 
     // Invalidate any data in the buffer:
-    global_uart_new_data = CLEAR;
+    global_uart_rx_tail = global_uart_rx_head;
 }
 
 /*
@@ -173,21 +224,46 @@ static void close_uart(void)
  * following code will branch to the high_interrupt_service_routine function to
  * handle interrupts that occur at the high vector.
  * 
- * Interrupt service routine for the UART, including buffering of one char.
+ * Interrupt service routine for the UART, including the receive ring buffer and asynchronous writes.
+ * The millisecond tick and the I2C transaction engine are serviced here as well.
  */
 void interrupt uart_isr(void)
 {
-    ubyte dummy;
+    ubyte c;
 
-    if (PIR1bits.RCIF == SET) {      // Service an EUSART receive interrupt
-        if (RCSTAbits.OERR || RCSTAbits.FERR) { // Overrun or frame error:
+    while (PIR1bits.RCIF == SET) {   // Service an EUSART receive interrupt, the FIFO holds two bytes
+        if (RCSTAbits.OERR) {       // Overrun: the FIFO stays stuck until the receiver is reset
+            global_uart_overflows++;
             RCSTAbits.CREN = CLEAR; // Reset the EUSART
-            dummy = RCREG;          // Dummy read to clear the RCIF flag
+            c = RCREG;              // Dummy read to clear the RCIF flag
             RCSTAbits.CREN = SET;   // Enable receiver again.
+            break;
+        }
+        if (RCSTAbits.FERR) {       // Framing error of the byte on top of the FIFO: skip it
+            global_uart_framing_errors++;
+            c = RCREG;
+            continue;
+        }
+        c = RCREG;                  // This will also clear the PIR1.RCIF flag
+        if ((ubyte)(global_uart_rx_head - global_uart_rx_tail) == UART_RX_SIZE) {
+            global_uart_overflows++;    // Ring buffer full: drop the newest byte
         }
         else {
-            global_uart_buffer = RCREG;  // This will also clear the PIR1.RCIF flag
-            global_uart_new_data = (ubyte)SET;
+            uart_rx_buf[global_uart_rx_head & UART_RX_MASK] = c;
+            global_uart_rx_head++;
         }
     }
+
+    if (PIE1bits.TXIE == SET && PIR1bits.TXIF == SET) {  // Send the next byte of an asynchronous write
+        TXREG = *uart_tx_buf++;
+        if (--global_uart_tx_len == 0) { PIE1bits.TXIE = CLEAR; }
+    }
+
+    if (PIE1bits.TMR1IE == SET && PIR1bits.TMR1IF == SET) {  // Millisecond tick
+        ticks_isr();
+    }
+
+    if ((PIE1bits.SSPIE == SET && PIR1bits.SSPIF == SET) || (PIE2bits.BCLIE == SET && PIR2bits.BCLIF == SET)) {
+        i2c_isr();      // Next step of the I2C transaction on the bus
+    }
 }
@@ -17,8 +17,17 @@ extern "C" {
 
 #include "defs.h"
 
+// Receive ring buffer: filled by the ISR, emptied by getc_uart() and read_uart(). The size must
+// be a power of two that divides 256, the head and tail indices run freely and wrap around.
+#define UART_RX_SIZE    64
+#define UART_RX_MASK    (UART_RX_SIZE - 1)
+
 // Global variables:
-extern volatile ubyte global_uart_new_data;
+extern volatile ubyte global_uart_rx_head;      // Written by the ISR only
+extern volatile ubyte global_uart_rx_tail;      // Written by the main loop only
+extern volatile ubyte global_uart_tx_len;
+extern volatile uint16 global_uart_overflows;   // Bytes lost: ring buffer full or EUSART overrun
+extern volatile uint16 global_uart_framing_errors;  // Bytes discarded because of a framing error
 
 // Defines:
 #define SELECT_GPS      0b00    // Selected by setting the COM SEL0 and COM SEL1 lines
@@ -40,13 +49,17 @@ extern volatile ubyte global_uart_new_data;
 // Specific defines:
 #define enable_serial()  COM_ENABLE_PIN = LOW;
 #define disable_serial() COM_ENABLE_PIN = HIGH;
-#define data_rdy_uart() (global_uart_new_data == (ubyte)SET)
+#define rx_count_uart() ((ubyte)(global_uart_rx_head - global_uart_rx_tail))
+#define data_rdy_uart() (global_uart_rx_head != global_uart_rx_tail)
+#define tx_busy_uart() (global_uart_tx_len != 0)
 
 // Function prototypes:
 ubyte   init_serial(void);
 void    serial_channel(ubyte channel);
 ubyte   getc_uart(void);
+ubyte   read_uart(ubyte *buf, ubyte n);
 void    putch(ubyte c);
+void    write_uart(const ubyte *buf, ubyte len);
 
 
 #ifdef	__cplusplus
@@ -8,22 +8,103 @@
  */
 
 #include "storage.h"
-#include "i2c.h"
+#include "eeprom.h"
 
 #include "serial.h"
 #include "util.h"
 
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
+
+
+// Write-behind buffer: telemetry records are collected into the image of the log page at the head
+// of the ring and written out with a single page write once the page is full. The buffer is
+// persistent so a partially filled page survives a watchdog reset (only a power-on reset leaves
+// RAM undefined).
+#define WB_MAGIC 0x5AA5
+static persistent struct {
+    uint16  magic;                          // WB_MAGIC iff the fields below can be trusted
+    uint16  page;                           // Head of the ring: page (0 - 1023) of the image
+    uint16  tail;                           // Tail of the ring: oldest page that has been written
+    ubyte   count;                          // Number of records in the image (0: no image)
+    ubyte   data[EEPROM_PAGE_SIZE];         // Page image (a log_page)
+    index_entry ix;                         // Index entry of the page image
+} wb;
+
+// Read cache: the last log page read from the EEPROM, so following records of the same page are
+// decoded without touching the bus. Any write to the cached page invalidates it.
+#define RD_NONE 0xFFFF
+static ubyte  rd[EEPROM_PAGE_SIZE];
+static uint16 rd_page = RD_NONE;            // Page in the cache, or RD_NONE
+static uint16 rd_hits;                      // Number of page reads answered by the cache
+static uint16 rd_misses;                    // Number of page reads that went to the EEPROM
+
+// Frame buffers of dump_storage():
+static ubyte df[2][DUMP_HEADER_SIZE + EEPROM_PAGE_SIZE + 2];
+
+// Configuration journal state:
+static ubyte  cj_next;                      // Entry the next config update will be written to
+static uint16 cj_seq;                       // Sequence number of the newest entry
+static uint16 cj_log_head;                  // Log head of the newest entry
+static uint16 cj_log_tail;                  // Log tail of the newest entry
+
+// Location of a page in the memory array, and of the index entry of a log page:
+#define PAGE_ADDR(p) ((uint24)(p) * EEPROM_PAGE_SIZE)
+#define INDEX_ADDR(p) (PAGE_ADDR(INDEX_FIRST_PAGE + ((p) - LOG_FIRST_PAGE) / INDEX_ENTRIES_PER_PAGE) + \
+                       ((p) - LOG_FIRST_PAGE) % INDEX_ENTRIES_PER_PAGE * sizeof(index_entry))
+
+// Navigating the ring of log pages:
+#define LOG_PAGE_VALID(p)   ((p) >= LOG_FIRST_PAGE && (p) < PAGES_PER_BLOCK * 2)
+#define LOG_NEXT(p)         ((uint16)((p) + 1) < (uint16)(PAGES_PER_BLOCK * 2) ? (uint16)((p) + 1) : (uint16)LOG_FIRST_PAGE)
+#define LOG_WRITTEN         ((uint16)((wb.page + LOG_PAGES - wb.tail) % LOG_PAGES))
+#define LOG_RING(i)         ((uint16)(LOG_FIRST_PAGE + (wb.tail - LOG_FIRST_PAGE + (i)) % LOG_PAGES))
+
+static ubyte load_config(void);
+static ubyte read_config_entry(ubyte i, config_entry *entry);
+static ubyte legacy_config(record *rec);
+static void  reset_log(void);
+static void  recover_log(void);
+static ubyte write_head(void);
+static ubyte read_first(uint16 page, uint16 *first);
+static ubyte read_flight_page(uint16 page, ubyte *buf);
+static ubyte read_cached(uint16 page);
+static void  index_add(index_entry *ix, record *rec, ubyte start);
+static void  index_page(log_page *page);
+static ubyte read_index(uint16 i, index_entry *ix);
+static ubyte query_match(log_query *q, record *rec);
 
 
 // Initialize by retrieving the most recent configuration block:
-ubyte init_storage(void)
+// @param cold True iff RAM contents are undefined (power-on reset), which discards the page buffer
+ubyte init_storage(ubyte cold)
 {
-    if (!retr_record(0, &global_config)) {
+    log_page *page = (log_page *)wb.data;
+    uint16 last;
+
+    if (!load_config()) {
         printf("\r\nError initializing storage\r\n");
         return FALSE;
     }
+
+    // After a watchdog reset the persistent buffer still holds the head of the ring. It is one
+    // record ahead of the config if the last cycle ended before its config was saved (flight.c
+    // saves the record first), that record is kept. Otherwise, or if the buffer does not match the
+    // last record of the config, search the ring for the head:
+    last = page->first + page->count - 1;
+    if (cold || wb.magic != WB_MAGIC || !LOG_PAGE_VALID(wb.page) || !LOG_PAGE_VALID(wb.tail) || \
+            wb.count == 0 || wb.count != page->count || !log_page_intact(page) || \
+            page->flight != global_config.ru.config.flight || \
+            (last != global_config.ru.config.last_record && last != global_config.ru.config.last_record + 1)) {
+        wb.magic = WB_MAGIC;
+        recover_log();
+    }
+    else {
+        global_config.ru.config.last_record = last;
+#ifdef DEBUG_ON
+        printf("Recovered %u buffered records of page %u\r\n", wb.count, wb.page);
+#endif
+    }
     printf("EEPROM ");
     return TRUE;
 }
@@ -36,129 +117,598 @@ ubyte init_storage(void)
  */
 ubyte wipe_storage(ubyte c)
 {
-     // There is only 120 bytes of stack frame avaiable:
-    ubyte buf[WIPE_BUFFER_SIZE];
     uint16 i;
 
-    memset(buf, c, WIPE_BUFFER_SIZE);
+    // The log is empty after a wipe (buffered records would otherwise be written over it):
+    reset_log();
+    global_config.ru.config.last_record = 0;
+    if (!save_config()) { return FALSE; }
 
-    // Wipe the first page of the first block (except the config record):
-    printf("Wiping EEPROM (any key to interrupt):\r\n");
-    printf("Low block, page 0\r\n");
-    if (!i2c_eeprom_page_write(sizeof(record), I2C_24LC1026_LOW_BLK, buf, WIPE_BUFFER_SIZE - sizeof(record), TRUE)) { return FALSE; }
-    if (!i2c_eeprom_page_write(WIPE_BUFFER_SIZE,      I2C_24LC1026_LOW_BLK, buf, WIPE_BUFFER_SIZE          , TRUE)) { return FALSE; }
+    // The read cache is free after resetting the log, it holds the page image to write:
+    memset(rd, c, EEPROM_PAGE_SIZE);
 
-    // Wipe all of pages 1 - 512 of the low block (B0 = 0):
-    for (i = 1; i < PAGES_PER_BLOCK; i++) {
-        printf("Low block, page %d\r\n", i);
-        if (!i2c_eeprom_page_write(i * I2C_24LC1026_PAGE_SIZE,                    I2C_24LC1026_LOW_BLK, buf, WIPE_BUFFER_SIZE, TRUE)) { return FALSE; }
-        if (!i2c_eeprom_page_write(i * I2C_24LC1026_PAGE_SIZE + WIPE_BUFFER_SIZE, I2C_24LC1026_LOW_BLK, buf, WIPE_BUFFER_SIZE, TRUE)) { return FALSE; }
+    // Wipe the index and the log, the event journal is kept. Each page is written while the write
+    // cycle of the previous one is still going on in the background:
+    printf("Wiping EEPROM (any key to interrupt):\r\n");
+    for (i = INDEX_FIRST_PAGE; i < PAGES_PER_BLOCK * 2; i++) {
+        printf("Page %u\r\n", i);
+        if (!eeprom_write(PAGE_ADDR(i), rd, EEPROM_PAGE_SIZE)) { return FALSE; }
 
         // Clear watchdog timer and check if user entered anything
         ClrWdt();
         if (data_rdy_uart()) { return TRUE; }
     }
+    return TRUE;
+}
+
+
+/**
+ * Stream the raw contents of the EEPROM to the serial as binary frames (see DUMP_SYNC), one page
+ * (or the rest of the page the offset is in) per frame. While one frame is being sent by the ISR,
+ * the next page is read into the other frame buffer, so the dump runs at the serial speed. A
+ * frame of length 0 ends the dump.
+ * @param offset Byte address (0 - DUMP_IMAGE_SIZE) to start at, so an interrupted dump can resume
+ * @return True iff the EEPROM could be read
+ */
+ubyte dump_storage(uint24 offset)
+{
+    ubyte *frame;
+    ubyte b = 0, len;
+    uint16 crc;
+
+    if (!flush_records()) { return FALSE; }     // The image includes buffered records
 
-    // Wipe all of the 512 pages of the high block (B0 = 1):
-    for (i = 0; i < PAGES_PER_BLOCK; i++) {
-        printf("High block, page %d\r\n", i);
-        if (!i2c_eeprom_page_write(i * I2C_24LC1026_PAGE_SIZE,                    I2C_24LC1026_HIGH_BLK, buf, WIPE_BUFFER_SIZE, TRUE)) { return FALSE; }
-        if (!i2c_eeprom_page_write(i * I2C_24LC1026_PAGE_SIZE + WIPE_BUFFER_SIZE, I2C_24LC1026_HIGH_BLK, buf, WIPE_BUFFER_SIZE, TRUE)) { return FALSE; }
+    while (TRUE) {
+        frame = df[b];
+        len = (offset < DUMP_IMAGE_SIZE) ? EEPROM_PAGE_SIZE - (ubyte)(offset % EEPROM_PAGE_SIZE) : 0;
+        frame[0] = DUMP_SYNC;
+        frame[1] = len;
+        frame[2] = (ubyte)offset;
+        frame[3] = (ubyte)(offset >> 8);
+        frame[4] = (ubyte)(offset >> 16);
+        if (len > 0 && !eeprom_read(offset, &frame[DUMP_HEADER_SIZE], len)) { return FALSE; }
+        crc = crc16_block(&frame[1], DUMP_HEADER_SIZE - 1 + len);
+        frame[DUMP_HEADER_SIZE + len] = (ubyte)crc;
+        frame[DUMP_HEADER_SIZE + len + 1] = (ubyte)(crc >> 8);
+        write_uart(frame, DUMP_HEADER_SIZE + len + 2);  // Waits until the other frame has been sent
+
+        if (len == 0) { break; }
+        offset += len;
+        b ^= 1;
 
         // Clear watchdog timer and check if user entered anything
         ClrWdt();
-        if (data_rdy_uart()) { return TRUE; }
+        if (data_rdy_uart()) { break; }
     }
+    while (tx_busy_uart()) { Nop(); }
     return TRUE;
 }
- 
+
 
 /**
- * Dump the contents of the EEPROM to the screen (32 bytes wide)
+ * Load the newest valid entry of the configuration journal into the global config.
+ * Entries are written in order with increasing sequence numbers, so the newest entry is the last
+ * one (counting from entry 0) whose sequence number continues that of entry 0. A binary search
+ * finds it in at most log2(CONFIG_ENTRIES) reads.
+ * @return True iff the EEPROM could be read
  */
-/*
-void dump_storage(void)
+static ubyte load_config(void)
 {
-    ubyte j = 0;
-    uint16 i;
-    ubyte buf[CHUNK_SIZE];
-
-    // 1. Display the contents of the lower block, 32 bytes at a time
-    printf("Dumping EEPROM (any key to interrupt):\r\n");
-    for (i = 0; i < CHUNKS_PER_BLOCK; i++) {
-        // Retrieve a chunk of 32 bytes:
-        if (!i2c_eeprom_sequence_read(i * CHUNK_SIZE, I2C_24LC1026_LOW_BLK, buf, CHUNK_SIZE)) {
-            printf("Error reading bytes at address 0%04Xh.\r\n", i * CHUNK_SIZE);
-            return;
-        }
+    config_entry entry;
+    ubyte lo, hi, mid;
+    uint16 seq0;
 
-        // Display it:
-        printf("0%04Xh: ", i * CHUNK_SIZE);
-        for (j = 0; j < CHUNK_SIZE; j++) {
-            if (j % 4 == 0) { putch(' '); }
-            if (j == CHUNK_SIZE / 2) { printf("- "); }
-            printf("%02X", buf[j]);
+    if (read_config_entry(0, &entry)) {
+        seq0 = entry.seq;
+        lo = 0;
+        hi = CONFIG_ENTRIES - 1;
+        while (lo < hi) {   // Invariant: entry lo continues the sequence of entry 0
+            mid = (ubyte)((lo + hi + 1) / 2);
+            if (read_config_entry(mid, &entry) && entry.seq == (uint16)(seq0 + mid)) { lo = mid; }
+            else { hi = mid - 1; }
         }
-        printf("\r\n");
+    }
+    else if (read_config_entry(CONFIG_ENTRIES - 1, &entry)) {
+        // Entry 0 is torn or was never written: the journal wrapped and the last entry is the newest
+        lo = CONFIG_ENTRIES - 1;
+    }
+    else {
+        // Empty journal: adopt the settings of an old-style config record at address 0, but start
+        // in command mode since the old-style log is no longer valid. Anything else there (such as
+        // a torn first journal entry) is not trusted, the defaults are used instead:
+        if (!eeprom_read(0, (ubyte *)&global_config, sizeof(record))) { return FALSE; }
+        if (!legacy_config(&global_config)) {
+            memset(&global_config, '\0', sizeof(record));
+            printf("Default config ");
+        }
+        global_config.ru.config.mode = MODE_COMMAND;
+        global_config.ru.config.log_format = DEFAULT_LOG_FORMAT;
+        global_config.ru.config.last_record = 0;
+        reset_log();
+        cj_next = 0;
+        cj_seq = 0;
+        printf("New config journal ");
+        return save_config();
+    }
 
-        // Clear watchdog timer and check if user entered anything
-        ClrWdt();
-        if (data_rdy_uart()) { return; }
+    // Reread the newest entry, the search may have ended on an older one:
+    if (!read_config_entry(lo, &entry)) { return FALSE; }
+    memcpy(&global_config, &entry.config, sizeof(record));
+    cj_log_head = entry.log_head;
+    cj_log_tail = entry.log_tail;
+    cj_seq = entry.seq;
+    cj_next = (lo + 1) % CONFIG_ENTRIES;
+#ifdef DEBUG_ON
+    printf("Config entry %u (seq %u) ", lo, cj_seq);
+#endif
+    return TRUE;
+}
+
+
+/**
+ * Sanity check of an old-style config record: it never has the config flag set (journal entries
+ * do), and all its settings are in range.
+ * @return True iff the record can be adopted
+ */
+static ubyte legacy_config(record *rec)
+{
+    ubyte i, c;
+
+    if (rec->status.config) { return FALSE; }
+    if (rec->ru.config.mode > MODE_LANDED && rec->ru.config.mode != MODE_ERROR) { return FALSE; }
+    if (rec->ru.config.l_hours > 23 || rec->ru.config.l_minutes > 59 || rec->ru.config.l_seconds > 59) { return FALSE; }
+    if (rec->ru.config.radio_invert > 1) { return FALSE; }
+    for (i = 0; i < SIZE_CELL_NUMBER; i++) {
+        c = rec->ru.config.cell_number[i];
+        if (c != '\0' && c != '+' && (c < '0' || c > '9')) { return FALSE; }
+    }
+    for (i = 0; i < SIZE_PHONE_PIN; i++) {
+        c = rec->ru.config.phone_pin[i];
+        if (c != '\0' && (c < '0' || c > '9')) { return FALSE; }
     }
+    return TRUE;
+}
 
-    // 2. Display the contents of the higher block, 32 bytes at a time
-    for (i = 0; i < CHUNKS_PER_BLOCK; i++) {
-        if (!i2c_eeprom_sequence_read(i * CHUNK_SIZE, I2C_24LC1026_HIGH_BLK, buf, CHUNK_SIZE)) {
-            printf("Error reading bytes at address 1%04Xh.\r\n", i * CHUNK_SIZE);
-            return;
-        }
 
-        // Display it:
-        printf("1%04Xh: ", i * CHUNK_SIZE);
-        for (j = 0; j < CHUNK_SIZE; j++) {
-            if (j % 4 == 0) { putch(' '); }
-            if (j == CHUNK_SIZE / 2) { printf("- "); }
-            printf("%02X", buf[j]);
+/**
+ * Read an entry of the configuration journal.
+ * @param i Entry number (0 - CONFIG_ENTRIES - 1)
+ * @param entry Entry to read into
+ * @return True iff the entry could be read and its CRC matches
+ */
+static ubyte read_config_entry(ubyte i, config_entry *entry)
+{
+    uint16 addr;
+
+    addr = (i / CONFIG_ENTRIES_PER_PAGE) * EEPROM_PAGE_SIZE + (i % CONFIG_ENTRIES_PER_PAGE) * sizeof(config_entry);
+    if (!eeprom_read(addr, (ubyte *)entry, sizeof(config_entry))) { return FALSE; }
+    return (crc16_block((ubyte *)entry, offsetof(config_entry, crc)) == entry->crc);
+}
+
+
+/**
+ * Append the global config to the configuration journal.
+ * @return True iff the entry was written
+ */
+ubyte save_config(void)
+{
+    config_entry entry;
+    uint16 addr;
+
+    memcpy(&entry.config, &global_config, sizeof(record));
+    entry.config.status.config = 1;     // Tells a (torn) entry from an old-style config record
+    entry.log_head = wb.page;
+    entry.log_tail = wb.tail;
+    entry.seq = cj_seq + 1;
+    entry.crc = crc16_block((ubyte *)&entry, offsetof(config_entry, crc));
+
+    addr = (cj_next / CONFIG_ENTRIES_PER_PAGE) * EEPROM_PAGE_SIZE + (cj_next % CONFIG_ENTRIES_PER_PAGE) * sizeof(config_entry);
+    if (!eeprom_write(addr, (ubyte *)&entry, sizeof(config_entry))) { return FALSE; }
+
+    cj_seq = entry.seq;
+    cj_next = (cj_next + 1) % CONFIG_ENTRIES;
+    return TRUE;
+}
+
+
+// Save the given telemetry record (numbered from 1) at the head of the log, in the log format of
+// the current flight. Records are buffered until their page is full or flush_records() is called.
+ubyte save_record(uint16 num, record *rec)
+{
+    log_page *page = (log_page *)wb.data;
+
+    if (num == 0) { return FALSE; }
+
+    if (wb.count > 0) {
+        if (num < page->first + page->count) { return FALSE; }     // Sequence numbers only increase
+
+        // Append the record to the buffered page, writing out the page as soon as it is full:
+        if (num == page->first + page->count && page->format == global_config.ru.config.log_format && \
+                log_page_append(page, rec)) {
+            wb.count = page->count;
+            index_add(&wb.ix, rec, FALSE);
+            if (log_page_full(page)) { return write_head(); }
+            return TRUE;
         }
-        printf("\r\n");
 
-        // Clear watchdog timer and check if user entered anything
-        ClrWdt();
-        if (data_rdy_uart()) { return; }
+        // The record does not fit: write out the page and start the next one
+        if (!write_head()) { return FALSE; }
     }
+
+    log_page_start(page, global_config.ru.config.log_format, global_config.ru.config.flight, num, rec);
+    wb.count = 1;
+    wb.ix.first = num;
+    index_add(&wb.ix, rec, TRUE);
+    return TRUE;
 }
-*/
 
 
-// Save the given record at the record slot (counted from 0) in the memory array:
-// NB: record slot 0 is reserved for configuration
-ubyte save_record(uint16 num, record *rec)
+// Retrieve the given telemetry record (numbered from 1). The pages of the ring start with
+// increasing sequence numbers from tail to head, so a binary search over the page headers finds
+// the page to decode. Records that have been overwritten by the ring can not be retrieved.
+ubyte retr_record(uint16 num, record *rec)
 {
-    // Determine whether to put the record in the high or low block:
-    if (num < RECORDS_PER_BLOCK) {  // Lower block (num cannot be negative)
-        if (!i2c_eeprom_page_write(num * sizeof(record), I2C_24LC1026_LOW_BLK,  (ubyte *)rec, sizeof(record), FALSE)) { return FALSE; }
+    log_page *page = (log_page *)wb.data;
+    uint16 lo, hi, mid, first;
+
+    if (num == 0) { return FALSE; }
+
+    // Records that are still in the write-behind buffer are served from RAM, as are the records
+    // of the page in the read cache:
+    if (wb.count > 0 && num >= page->first) { return log_page_decode(page, num, rec); }
+    if (rd_page != RD_NONE && num >= ((log_page *)rd)->first && num - ((log_page *)rd)->first < ((log_page *)rd)->count) {
+        rd_hits++;
+        return log_page_decode((log_page *)rd, num, rec);
     }
-    else if (num >= RECORDS_PER_BLOCK && num < RECORDS_PER_BLOCK * 2) { // High block
-        if (!i2c_eeprom_page_write(num * sizeof(record), I2C_24LC1026_HIGH_BLK, (ubyte *)rec, sizeof(record), FALSE)) { return FALSE; }
+    if (LOG_WRITTEN == 0) { return FALSE; }
+
+    lo = 0;
+    hi = LOG_WRITTEN - 1;
+    while (lo < hi) {   // Find the last written page with a first record at or before num
+        mid = (lo + hi + 1) / 2;
+        if (!read_first(LOG_RING(mid), &first)) { return FALSE; }
+        if (first <= num) { lo = mid; }
+        else { hi = mid - 1; }
     }
-    else { return FALSE; } // Wrong number - unable to fit in memory
 
-    delay_1sec();   // Just to make sure the record is properly written
+    if (!read_cached(LOG_RING(lo))) { return FALSE; }
+    return log_page_decode((log_page *)rd, num, rec);
+}
+
+
+/**
+ * Report the hit and miss counters of the read cache.
+ * @param hits Number of page reads answered by the cache
+ * @param misses Number of page reads that went to the EEPROM
+ */
+void read_cache_stats(uint16 *hits, uint16 *misses)
+{
+    *hits = rd_hits;
+    *misses = rd_misses;
+}
+
+
+/**
+ * Determine the oldest record that is still in the log.
+ * @param num Sequence number of the oldest record (last_record + 1 if the log is empty)
+ * @return True iff the EEPROM could be read
+ */
+ubyte oldest_record(uint16 *num)
+{
+    if (LOG_WRITTEN > 0) { return read_first(wb.tail, num); }
 
+    *num = (wb.count > 0) ? ((log_page *)wb.data)->first : global_config.ru.config.last_record + 1;
     return TRUE;
 }
 
 
-ubyte retr_record(uint16 num, record *rec)
+/**
+ * Write the buffered page to the EEPROM with a single page write. The page stays in the buffer,
+ * so following records are still added to it.
+ * @return True iff the buffered records are stored in the EEPROM
+ */
+ubyte flush_records(void)
+{
+    if (wb.count == 0) { return TRUE; }
+    if (rd_page == wb.page) { rd_page = RD_NONE; }
+    return eeprom_write(PAGE_ADDR(wb.page), wb.data, EEPROM_PAGE_SIZE);
+}
+
+
+/**
+ * Start logging a new flight.
+ * @param format Format of the telemetry records (RECORD_V1, RECORD_V2 or RECORD_DELTA)
+ * @return True iff records still buffered from a previous flight could be written out
+ */
+ubyte start_log(ubyte format)
 {
-    // Determine whether to retrieve the record from the high or low block:
-    if (num < RECORDS_PER_BLOCK) {  // Lower block (num cannot be negative)
-        if (!i2c_eeprom_sequence_read(num * sizeof(record), I2C_24LC1026_LOW_BLK,  (ubyte *)rec, sizeof(record))) { return FALSE; }
+    ubyte ok;
+
+    ok = flush_records();
+    global_config.ru.config.log_format = format;
+    global_config.ru.config.flight++;   // Pages of earlier flights are no longer part of the log
+    global_config.ru.config.last_record = 0;
+    reset_log();
+    return ok;
+}
+
+
+/**
+ * Empty the ring of log pages.
+ */
+static void reset_log(void)
+{
+    rd_page = RD_NONE;
+    wb.page = LOG_FIRST_PAGE;
+    wb.tail = LOG_FIRST_PAGE;
+    wb.count = 0;
+}
+
+
+/**
+ * Write out the page at the head of the ring and advance the head. When the head catches up with
+ * the tail, the oldest page is given up. The index entry of the page is written along with it. The
+ * write cycle of the EEPROM goes on in the background, the next EEPROM transaction waits for it.
+ * @return True iff the page was written
+ */
+static ubyte write_head(void)
+{
+    if (rd_page == wb.page) { rd_page = RD_NONE; }
+    if (!eeprom_write(PAGE_ADDR(wb.page), wb.data, EEPROM_PAGE_SIZE)) { return FALSE; }
+    if (!eeprom_write(INDEX_ADDR(wb.page), (ubyte *)&wb.ix, sizeof(index_entry))) { return FALSE; }
+
+    wb.page = LOG_NEXT(wb.page);
+    if (wb.page == wb.tail) { wb.tail = LOG_NEXT(wb.tail); }
+    wb.count = 0;
+    return TRUE;
+}
+
+
+/**
+ * Read a log page into the read cache with a single sequential read, unless it is cached already.
+ * @param page The page (LOG_FIRST_PAGE ... 1023)
+ * @return True iff the page is in the cache
+ */
+static ubyte read_cached(uint16 page)
+{
+    if (rd_page == page) {
+        rd_hits++;
+        return TRUE;
+    }
+
+    rd_misses++;
+    rd_page = RD_NONE;
+    if (!eeprom_read(PAGE_ADDR(page), rd, EEPROM_PAGE_SIZE)) { return FALSE; }
+    rd_page = page;
+    return TRUE;
+}
+
+
+/**
+ * Read the sequence number of the first record of a log page (from the read cache if possible).
+ */
+static ubyte read_first(uint16 page, uint16 *first)
+{
+    if (rd_page == page) {
+        *first = ((log_page *)rd)->first;
+        return TRUE;
+    }
+    return eeprom_read(PAGE_ADDR(page), (ubyte *)first, sizeof(uint16));
+}
+
+
+/**
+ * Read a log page and check that it is intact and belongs to the current flight.
+ * @param page The page (LOG_FIRST_PAGE ... 1023)
+ * @param buf Buffer of EEPROM_PAGE_SIZE bytes to read the page into
+ * @return True iff the page holds records of the current flight
+ */
+static ubyte read_flight_page(uint16 page, ubyte *buf)
+{
+    if (!eeprom_read(PAGE_ADDR(page), buf, EEPROM_PAGE_SIZE)) { return FALSE; }
+    return log_page_intact((log_page *)buf) && ((log_page *)buf)->flight == global_config.ru.config.flight;
+}
+
+
+/**
+ * Find the head of the log ring when the page buffer can not be trusted, without relying on the
+ * last record of the config. From the tail onwards, the pages of the current flight start with
+ * increasing sequence numbers (at least one more per page), until the first page that is torn,
+ * stale or from another flight. A binary search over the ring finds the last of them with about
+ * 10 page-sized reads, well within a watchdog cycle. That page is reloaded as the head, so records
+ * that were flushed to it are kept and following records are appended to it.
+ */
+static void recover_log(void)
+{
+    log_page *page = (log_page *)wb.data;
+    uint16 lo, hi, mid, first;
+    ubyte found;
+
+    reset_log();
+    if (LOG_PAGE_VALID(cj_log_tail)) { wb.tail = cj_log_tail; }
+
+    // The config may predate a page write that overwrote (or tore) the tail page:
+    found = read_flight_page(wb.tail, rd);
+    first = ((log_page *)rd)->first;
+    if (read_flight_page(LOG_NEXT(wb.tail), rd) && (!found || ((log_page *)rd)->first < first)) {
+        wb.tail = LOG_NEXT(wb.tail);
+        first = ((log_page *)rd)->first;
+        found = TRUE;
+    }
+    if (!found) {
+#ifdef DEBUG_ON
+        printf("Log empty (%u lost) ", global_config.ru.config.last_record);
+#endif
+        global_config.ru.config.last_record = 0;
+        return;
+    }
+
+    lo = 0;
+    hi = LOG_PAGES - 1;
+    while (lo < hi) {   // Invariant: page lo of the ring continues the sequence of the tail page
+        mid = (lo + hi + 1) / 2;
+        if (read_flight_page(LOG_RING(mid), rd) && ((log_page *)rd)->first >= first && \
+                ((log_page *)rd)->first - first >= mid) { lo = mid; }
+        else { hi = mid - 1; }
+    }
+
+    // Reload the last page as the head of the ring:
+    wb.page = LOG_RING(lo);
+    read_flight_page(wb.page, wb.data);
+    wb.count = page->count;
+    index_page(page);
+
+#ifdef DEBUG_ON
+    printf("Log resumes after record %u (%u lost) ", page->first + page->count - 1, \
+            global_config.ru.config.last_record - (page->first + page->count - 1));
+#endif
+    global_config.ru.config.last_record = page->first + page->count - 1;
+}
+
+
+/**
+ * Add a record to the index entry of its page.
+ * @param ix The index entry
+ * @param rec The record
+ * @param start True iff the record is the first of the page
+ */
+static void index_add(index_entry *ix, record *rec, ubyte start)
+{
+    sint32 alt = (sint32)rec->ru.telemetry.alt_gps + V2_ALT_OFFSET;
+    ubyte lo, hi;
+
+    if (alt < 0) { alt = 0; }
+    else if (alt > (sint32)UCHAR_MAX * INDEX_ALT_UNIT - 1) { alt = (sint32)UCHAR_MAX * INDEX_ALT_UNIT - 1; }
+    lo = (ubyte)(alt / INDEX_ALT_UNIT);
+    hi = (ubyte)((alt + INDEX_ALT_UNIT - 1) / INDEX_ALT_UNIT);
+
+    if (start) {
+        ix->time = (uint24)record_time(rec);
+        ix->alt_min = lo;
+        ix->alt_max = hi;
+        ix->flags = rec->status.status_byte;
+        return;
     }
-    else if (num >= RECORDS_PER_BLOCK && num < RECORDS_PER_BLOCK * 2) { // High block
-        if (!i2c_eeprom_sequence_read(num * sizeof(record), I2C_24LC1026_HIGH_BLK, (ubyte *)rec, sizeof(record))) { return FALSE; }
+    if (lo < ix->alt_min) { ix->alt_min = lo; }
+    if (hi > ix->alt_max) { ix->alt_max = hi; }
+    ix->flags |= rec->status.status_byte;
+}
+
+
+/**
+ * Rebuild the index entry of the page image from its records.
+ */
+static void index_page(log_page *page)
+{
+    record rec;
+    ubyte i;
+
+    wb.ix.first = page->first;
+    for (i = 0; i < page->count; i++) {
+        memset(&rec, '\0', sizeof(record));
+        log_page_decode(page, page->first + i, &rec);
+        index_add(&wb.ix, &rec, i == 0);
+    }
+}
+
+
+/**
+ * Read the index entry of a page of the ring.
+ * @param i Ring index of the page (LOG_WRITTEN: the head, which is summarized in RAM)
+ * @param ix The index entry
+ * @return True iff the entry could be read
+ */
+static ubyte read_index(uint16 i, index_entry *ix)
+{
+    if (i == LOG_WRITTEN) {
+        memcpy(ix, &wb.ix, sizeof(index_entry));
+        return (wb.count > 0);
     }
-    else { return FALSE; } // Wrong number - unable to fit in memory or tried to save in config slot
+    return eeprom_read(INDEX_ADDR(LOG_RING(i)), (ubyte *)ix, sizeof(index_entry));
+}
+
 
+/**
+ * Start a range query over the log. Set the ranges and flags of the query before calling.
+ * @param q The query
+ * @return True iff the EEPROM could be read
+ */
+ubyte query_log(log_query *q)
+{
+    q->pos = 0;
+    q->num = 0;
+    q->pages = 0;
+    if (!oldest_record(&q->prev)) { return FALSE; }
+    q->ix_ok = read_index(0, &q->ix) && q->ix.first == q->prev;
     return TRUE;
 }
+
+
+/**
+ * Find the next record that matches a range query. Pages whose index entry does not match are
+ * skipped without reading them. An index entry that does not continue the sequence numbers of the
+ * entries before it (a page write that was not followed by its entry) is not trusted, its page is
+ * read instead.
+ * @param q The query, started with query_log()
+ * @param num Sequence number of the record found
+ * @param rec The record found
+ * @return True iff a record was found, FALSE at the end of the log
+ */
+ubyte query_next(log_query *q, uint16 *num, record *rec)
+{
+    log_page *page;
+    index_entry next;
+    ubyte next_ok, match;
+
+    while (TRUE) {
+        // Walk the records of a matching page:
+        while (q->num != 0) {
+            *num = q->num;
+            q->num = (q->num < q->last) ? q->num + 1 : 0;
+            if (q->page == wb.page && wb.count > 0) { page = (log_page *)wb.data; }
+            else if (read_cached(q->page)) { page = (log_page *)rd; }
+            else { return FALSE; }
+            if (log_page_decode(page, *num, rec) && query_match(q, rec)) { return TRUE; }
+        }
+
+        if (q->pos > LOG_WRITTEN || (q->pos == LOG_WRITTEN && wb.count == 0)) { return FALSE; }
+
+        // The first record of the next page ends the time span of this one:
+        next_ok = (q->pos < LOG_WRITTEN) && read_index(q->pos + 1, &next);
+        match = !q->ix_ok || ( \
+                q->ix.time <= q->time_to && (!next_ok || next.time >= q->time_from) && \
+                (sint32)q->ix.alt_max * INDEX_ALT_UNIT - V2_ALT_OFFSET >= q->alt_from && \
+                (sint32)q->ix.alt_min * INDEX_ALT_UNIT - V2_ALT_OFFSET <= q->alt_to && \
+                (q->ix.flags & q->flags) == q->flags);
+
+        if (match) {
+            q->page = LOG_RING(q->pos);
+            if (q->page == wb.page && wb.count > 0) { page = (log_page *)wb.data; }
+            else if (read_cached(q->page)) { page = (log_page *)rd; }
+            else { return FALSE; }
+            q->num = page->first;
+            q->last = page->first + page->count - 1;
+            q->pages++;
+            ClrWdt();
+        }
+
+        // Move on, trusting the next entry only if it continues the sequence:
+        if (q->ix_ok) { q->prev = q->ix.first; }
+        q->ix_ok = next_ok && next.first > q->prev && next.first <= global_config.ru.config.last_record;
+        memcpy(&q->ix, &next, sizeof(index_entry));
+        q->pos++;
+    }
+}
+
+
+/**
+ * Check a record against the ranges and flags of a query.
+ */
+static ubyte query_match(log_query *q, record *rec)
+{
+    uint32 t = record_time(rec);
+
+    return t >= q->time_from && t <= q->time_to && \
+           rec->ru.telemetry.alt_gps >= q->alt_from && rec->ru.telemetry.alt_gps <= q->alt_to && \
+           (rec->status.status_byte & q->flags) == q->flags;
+}
@@ -16,21 +16,96 @@ extern "C" {
 
 #include "defs.h"
 #include "record.h"
-#include "i2c.h"
+#include "eeprom.h"
+#include "events.h"
+
+#include <limits.h>
 
 // Defines
-#define WIPE_BUFFER_SIZE (I2C_24LC1026_PAGE_SIZE / 2)
-#define PAGES_PER_BLOCK (I2C_24LC1026_BLOCK_SIZE / I2C_24LC1026_PAGE_SIZE)
-#define RECORDS_PER_BLOCK (I2C_24LC1026_BLOCK_SIZE / sizeof(record))
-#define CHUNK_SIZE 32
-#define CHUNKS_PER_BLOCK (I2C_24LC1026_BLOCK_SIZE / CHUNK_SIZE)
+#define PAGES_PER_BLOCK (I2C_24LC1026_BLOCK_SIZE / EEPROM_PAGE_SIZE)
+#define DEFAULT_LOG_FORMAT RECORD_DELTA
+
+// Binary dump frames: DUMP_SYNC, data length (0 - 128, 0 ends the dump), 17-bit byte address of the
+// data (3 bytes, LSB first), the data and a CRC16 (LSB first) over the length, address and data.
+#define DUMP_SYNC 0xA5
+#define DUMP_HEADER_SIZE 5
+#define DUMP_IMAGE_SIZE EEPROM_SIZE
+
+// Configuration journal: the first pages of the low block hold append-only copies of the global
+// config. Each update goes to the next entry (wrapping around), so no single page wears out.
+typedef struct {
+    record      config;             // Copy of the global config
+    uint16      log_head;           // Log page being filled (newest records)
+    uint16      log_tail;           // Oldest log page that has been written
+    uint16      seq;                // Sequence number, incremented for each entry written
+    uint16      crc;                // CRC16 over the config and sequence number
+} config_entry;
+
+#define CONFIG_JOURNAL_PAGES 32
+#define CONFIG_JOURNAL_SIZE (CONFIG_JOURNAL_PAGES * EEPROM_PAGE_SIZE)
+#define CONFIG_ENTRIES_PER_PAGE (EEPROM_PAGE_SIZE / sizeof(config_entry))
+#define CONFIG_ENTRIES (CONFIG_JOURNAL_PAGES * CONFIG_ENTRIES_PER_PAGE)
+
+// Event journal: a ring of event entries following the configuration journal (see events.h).
+#define EVENT_FIRST_PAGE CONFIG_JOURNAL_PAGES
+
+// Log index: the pages following the event journal hold one entry per log page, written
+// once the log page is full (the page at the head of the ring is summarized in RAM). Range queries
+// read the index and only the log pages whose entry matches.
+typedef struct {
+    uint16      first;              // Sequence number of the first record of the page
+    uint24      time;               // Time of the first record (seconds since 00:00 UTC on the launch day)
+    ubyte       alt_min;            // Lowest GPS altitude plus V2_ALT_OFFSET in INDEX_ALT_UNITs, rounded down
+    ubyte       alt_max;            // Highest GPS altitude plus V2_ALT_OFFSET in INDEX_ALT_UNITs, rounded up
+    ubyte       flags;              // Status bytes of the records OR'ed together
+} index_entry;
+
+#define INDEX_ALT_UNIT 256
+#define INDEX_ENTRIES_PER_PAGE (EEPROM_PAGE_SIZE / sizeof(index_entry))
+#define INDEX_FIRST_PAGE (EVENT_FIRST_PAGE + EVENT_PAGES)
+#define INDEX_PAGES (PAGES_PER_BLOCK * 2 - INDEX_FIRST_PAGE - LOG_PAGES)
+
+// The telemetry log is a ring of log pages following the index, spanning both blocks. Every log
+// page takes a page plus one index entry of the remaining pages. Once the ring is full the oldest
+// page is overwritten. Records are numbered from 1 with a sequence number that keeps increasing,
+// so only the 16 bits of that number limit a flight.
+#define LOG_FIRST_PAGE (INDEX_FIRST_PAGE + INDEX_PAGES)
+#define LOG_PAGES ((PAGES_PER_BLOCK * 2 - INDEX_FIRST_PAGE) * INDEX_ENTRIES_PER_PAGE / (INDEX_ENTRIES_PER_PAGE + 1))
+#define MAX_RECORD USHRT_MAX
+
+// Range query over the log (see query_log()). Records match if they lie in both ranges and have
+// all of the flags set.
+typedef struct {
+    uint24      time_from;          // Seconds since 00:00 UTC on the launch day
+    uint24      time_to;
+    sint24      alt_from;           // GPS altitude in meters
+    sint24      alt_to;
+    ubyte       flags;              // Status flags (as in the record status byte) that must be set
+
+    // Progress, set up by query_log():
+    uint16      pos;                // Ring index of the next page to look at (LOG_WRITTEN: the head)
+    uint16      page;               // Page being walked
+    uint16      num;                // Next record of the page being walked, 0 if none
+    uint16      last;               // Last record of the page being walked
+    uint16      prev;               // First record of the last trusted index entry
+    index_entry ix;                 // Index entry of the page at pos
+    ubyte       ix_ok;              // True iff that entry can be trusted
+    uint16      pages;              // Number of log pages read
+} log_query;
 
 // Protypes
-ubyte init_storage(void);
+ubyte init_storage(ubyte cold);
+ubyte save_config(void);
+ubyte start_log(ubyte format);
 ubyte wipe_storage(ubyte c);
-/* void  dump_storage(void); */
+ubyte dump_storage(uint24 offset);
 ubyte save_record(uint16 num, record *rec);
 ubyte retr_record(uint16 num, record *rec);
+ubyte oldest_record(uint16 *num);
+void  read_cache_stats(uint16 *hits, uint16 *misses);
+ubyte flush_records(void);
+ubyte query_log(log_query *q);
+ubyte query_next(log_query *q, uint16 *num, record *rec);
 
 #ifdef	__cplusplus
 }
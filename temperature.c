@@ -45,10 +45,13 @@ sint16  get_internal_temp(void)
 }
 
 
+/**
+ * @return The temperature in 1/16C, SHRT_MAX on error (the scratchpad fails its CRC)
+ */
 sint16  get_external_temp(void)
 {
     sint16 result = 0xff;
-    ubyte msb, lsb;
+    ubyte pad[OW_SCRATCHPAD_LEN], i;
 
     OW_reset_pulse();
     OW_write_byte(OW_SKIP_ROM);
@@ -60,9 +63,9 @@ sint16  get_external_temp(void)
     OW_reset_pulse();
     OW_write_byte(OW_SKIP_ROM);
     OW_write_byte(OW_READ_SCRATCHPAD);              // Start reading the 9 bytes from the scratchpad
-    lsb = OW_read_byte();                           // Scratchpad byte 0: LSB of temperature
-    msb = OW_read_byte();                           // Scratchpad byte 1: MSB of temperature
+    for (i = 0; i < OW_SCRATCHPAD_LEN; i++) { pad[i] = OW_read_byte(); }
+    if (OW_crc8(pad, OW_SCRATCHPAD_LEN) != 0) { return SHRT_MAX; }     // Also when no slave answers (all 1s)
 
-    result = ((sint16)msb << 8) | (sint16)lsb;
+    result = ((sint16)pad[1] << 8) | (sint16)pad[0]; // Scratchpad bytes 0 and 1: LSB and MSB of temperature
     return result;
 }
@@ -0,0 +1,91 @@
+/*
+ * File:   decode_events.c
+ * Author: Maurits
+ *
+ * Created on 17 october 2026
+ *
+ * Linux host tool that decodes the event journal (see events.h) from an EEPROM image captured
+ * with dump_image, oldest event first. Events of one cycle share the record number, which ties
+ * them to the GPS time of that record in the log.
+ *
+ * Build (from the repository root):
+ *   gcc -O2 -Wall -I. -Itools -o decode_events tools/decode_events.c
+ * Usage: ./decode_events eeprom.bin
+ */
+
+#include "storage.h"
+#include "events.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *event_names[EVENT_IDS] = EVENT_NAMES;
+static const char *init_names[] = { "storage", "gsm", "radio", "bmp180", "temperature", "events" };
+
+static unsigned char image[EVENT_ENTRIES * sizeof(event_entry)];
+
+static void print_event(const event_entry *e);
+
+
+int main(int argc, char **argv)
+{
+    const event_entry *ring = (const event_entry *)image;
+    unsigned int i, first, n;
+    FILE *in;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <image file>\n", argv[0]);
+        return 1;
+    }
+    if ((in = fopen(argv[1], "rb")) == NULL || \
+            fseek(in, (long)EVENT_FIRST_PAGE * EEPROM_PAGE_SIZE, SEEK_SET) != 0 || \
+            fread(image, 1, sizeof(image), in) != sizeof(image)) {
+        fprintf(stderr, "Error reading %s: %s\n", argv[1], errno ? strerror(errno) : "short file");
+        return 1;
+    }
+    fclose(in);
+
+    // The oldest event follows the newest, which is the last entry continuing the sequence of
+    // entry 0 (see init_events()):
+    n = 0;
+    if (ring[0].id < EVENT_IDS) {
+        for (n = 1; n < EVENT_ENTRIES && ring[n].id < EVENT_IDS && ring[n].seq == (uint16)(ring[0].seq + n); n++) { }
+    }
+    first = (n < EVENT_ENTRIES && ring[n].id < EVENT_IDS) ? n : 0;
+    if (first != 0) { n = EVENT_ENTRIES; }
+
+    printf("%u events\n", n);
+    printf("  seq  record        ms  event\n");
+    for (i = 0; i < n; i++) {
+        print_event(&ring[(first + i) % EVENT_ENTRIES]);
+    }
+    return 0;
+}
+
+
+static void print_event(const event_entry *e)
+{
+    printf("%5u  %6u  %8.3f  %-10s", e->seq, e->record, e->ms / 1000.0, event_names[e->id]);
+    switch (e->id) {
+        case EVENT_WATCHDOG:
+            printf(" in mode %u", e->payload); break;
+        case EVENT_INIT_FAIL:
+            if (e->payload < sizeof(init_names) / sizeof(init_names[0])) { printf(" %s", init_names[e->payload]); }
+            else { printf(" %u", e->payload); }
+            break;
+        case EVENT_MODE:
+            printf(" %u", e->payload); break;
+        case EVENT_GSM:
+            printf(" %s", e->payload ? "on" : "off"); break;
+        case EVENT_GPS_MISS:
+            printf(" last fix %u acquisitions old", e->payload); break;
+        case EVENT_GPS_WAKE:
+            if (e->payload == 255) { printf(" no fix before the deadline"); }
+            else { printf(" fix after %u s", e->payload); }
+            break;
+        default:
+            break;
+    }
+    printf("\n");
+}
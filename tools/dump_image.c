@@ -0,0 +1,223 @@
+/*
+ * File:   dump_image.c
+ * Author: Maurits
+ *
+ * Created on 17 october 2026
+ *
+ * Linux host tool that captures the binary dump of the 'd' command and reconstructs the 128 KB
+ * image of the 24LC1026 EEPROM. Frames with a bad CRC, gaps and time-outs are recovered from by
+ * interrupting the dump and resuming it from the first missing byte.
+ *
+ * Build: gcc -O2 -Wall -o dump_image dump_image.c
+ * Usage: ./dump_image /dev/ttyUSB0 eeprom.bin
+ * The flight controller must be in command mode (main menu) on the PC channel (115200 baud).
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Frame format, see storage.h:
+#define DUMP_SYNC           0xA5
+#define DUMP_HEADER_SIZE    5
+#define DUMP_IMAGE_SIZE     131072
+#define DUMP_MAX_DATA       128
+
+#define TIMEOUT_MS          2000    // Time-out waiting for the next byte
+#define MAX_RETRIES         20      // Resumes without progress before giving up
+
+static unsigned char image[DUMP_IMAGE_SIZE];
+
+static int open_serial(const char *dev);
+static int read_byte(int fd, unsigned char *c);
+static void start_dump(int fd, unsigned long offset);
+static void abort_dump(int fd);
+static unsigned short crc16_update(unsigned short crc, unsigned char data);
+static double now(void);
+
+
+int main(int argc, char **argv)
+{
+    unsigned char frame[DUMP_HEADER_SIZE + DUMP_MAX_DATA + 2];
+    unsigned long offset = 0, frame_offset;
+    unsigned short crc;
+    unsigned int len, i;
+    int fd, retries = 0, done = 0, bad_frames = 0;
+    double start;
+    FILE *out;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <serial device> <image file>\n", argv[0]);
+        return 1;
+    }
+    if ((fd = open_serial(argv[1])) < 0) { return 1; }
+
+    start = now();
+    start_dump(fd, offset);
+    while (!done) {
+        // Find the start of a frame:
+        if (!read_byte(fd, &frame[0])) { goto resume; }
+        if (frame[0] != DUMP_SYNC) { continue; }
+
+        // Header: length and 17-bit address (LSB first):
+        for (i = 1; i < DUMP_HEADER_SIZE; i++) {
+            if (!read_byte(fd, &frame[i])) { goto resume; }
+        }
+        len = frame[1];
+        frame_offset = frame[2] | ((unsigned long)frame[3] << 8) | ((unsigned long)frame[4] << 16);
+        if (len > DUMP_MAX_DATA || frame_offset != offset) { continue; }     // Not a frame: resync
+
+        // Data and CRC16 (LSB first):
+        for (i = 0; i < len + 2; i++) {
+            if (!read_byte(fd, &frame[DUMP_HEADER_SIZE + i])) { goto resume; }
+        }
+        crc = 0xffff;
+        for (i = 1; i < DUMP_HEADER_SIZE + len; i++) { crc = crc16_update(crc, frame[i]); }
+        if (crc != (frame[DUMP_HEADER_SIZE + len] | (frame[DUMP_HEADER_SIZE + len + 1] << 8))) {
+            bad_frames++;
+            goto resume;
+        }
+
+        if (len == 0) {
+            done = (offset == DUMP_IMAGE_SIZE);
+            if (!done) { goto resume; }     // The dump was interrupted early
+            break;
+        }
+        memcpy(&image[offset], &frame[DUMP_HEADER_SIZE], len);
+        offset += len;
+        retries = 0;
+        if (offset % 8192 == 0) {
+            fprintf(stderr, "\r%6lu / %d bytes (%.1f s)", offset, DUMP_IMAGE_SIZE, now() - start);
+        }
+        continue;
+
+resume:
+        if (++retries > MAX_RETRIES) {
+            fprintf(stderr, "\nNo progress at offset %lu, giving up\n", offset);
+            return 1;
+        }
+        fprintf(stderr, "\nResuming at offset %lu\n", offset);
+        abort_dump(fd);
+        start_dump(fd, offset);
+    }
+
+    fprintf(stderr, "\r%6lu / %d bytes in %.1f s (%d bad frames)\n", offset, DUMP_IMAGE_SIZE, now() - start, bad_frames);
+    close(fd);
+
+    if ((out = fopen(argv[2], "wb")) == NULL || fwrite(image, 1, DUMP_IMAGE_SIZE, out) != DUMP_IMAGE_SIZE) {
+        fprintf(stderr, "Error writing %s: %s\n", argv[2], strerror(errno));
+        return 1;
+    }
+    fclose(out);
+    return 0;
+}
+
+
+/**
+ * Open the serial device raw at 115200 baud, 8N1.
+ * @return File descriptor, or -1 on error
+ */
+static int open_serial(const char *dev)
+{
+    struct termios tio;
+    int fd;
+
+    if ((fd = open(dev, O_RDWR | O_NOCTTY)) < 0 || tcgetattr(fd, &tio) < 0) {
+        fprintf(stderr, "Error opening %s: %s\n", dev, strerror(errno));
+        return -1;
+    }
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, B115200);
+    cfsetospeed(&tio, B115200);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~CRTSCTS;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    if (tcsetattr(fd, TCSANOW, &tio) < 0) {
+        fprintf(stderr, "Error configuring %s: %s\n", dev, strerror(errno));
+        return -1;
+    }
+    return fd;
+}
+
+
+/**
+ * Read a single byte, buffered.
+ * @return 1 iff a byte was read before the time-out
+ */
+static int read_byte(int fd, unsigned char *c)
+{
+    static unsigned char buf[4096];
+    static int pos = 0, n = 0;
+    struct timeval tv;
+    fd_set fds;
+
+    if (pos == n) {
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+        tv.tv_sec = TIMEOUT_MS / 1000;
+        tv.tv_usec = (TIMEOUT_MS % 1000) * 1000;
+        if (select(fd + 1, &fds, NULL, NULL, &tv) <= 0) { return 0; }
+        if ((n = read(fd, buf, sizeof(buf))) <= 0) { n = 0; return 0; }
+        pos = 0;
+    }
+    *c = buf[pos++];
+    return 1;
+}
+
+
+/**
+ * Issue the 'd' command with the byte offset to start at.
+ */
+static void start_dump(int fd, unsigned long offset)
+{
+    char cmd[16];
+
+    if (write(fd, "d", 1) != 1) { return; }
+    usleep(200000);     // Wait for the prompt
+    snprintf(cmd, sizeof(cmd), "%lu\r", offset);
+    if (write(fd, cmd, strlen(cmd)) != (ssize_t)strlen(cmd)) { return; }
+}
+
+
+/**
+ * Interrupt a running dump (any key does) and discard what is still underway.
+ */
+static void abort_dump(int fd)
+{
+    unsigned char c;
+
+    if (write(fd, "\r", 1) != 1) { return; }
+    while (read_byte(fd, &c)) { }   // Drain until the line is quiet
+    tcflush(fd, TCIFLUSH);
+}
+
+
+/**
+ * Update a CRC16 (XMODEM polynomial 0x1021) with a single byte, as in util.c.
+ */
+static unsigned short crc16_update(unsigned short crc, unsigned char data)
+{
+    int i;
+
+    crc ^= (unsigned short)data << 8;
+    for (i = 0; i < 8; i++) {
+        crc = (crc & 0x8000) ? (unsigned short)((crc << 1) ^ 0x1021) : (unsigned short)(crc << 1);
+    }
+    return crc;
+}
+
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
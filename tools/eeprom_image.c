@@ -0,0 +1,222 @@
+/*
+ * File:   eeprom_image.c
+ * Author: Maurits
+ *
+ * Created on 17 october 2026
+ *
+ * Storage backend for host builds: the 24LC1026 as a memory mapped 128 KB image file (for example
+ * one captured with dump_image). The device is modelled the way i2c.c drives it:
+ *  - a page write only changes the page it starts in, data beyond the end of the page wraps
+ *    around to the start of that page;
+ *  - a sequential read wraps around within its 64 KB block;
+ *  - after a page write the device is busy for its write cycle, the next access acknowledge
+ *    polls until the cycle is over;
+ *  - bus time is counted per bit, so benchmarks give the time the transfers would take.
+ * The number of writes to each page is counted and kept in <image>.wear across runs.
+ */
+
+#include "eeprom_image.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static unsigned char *image = NULL;
+static int image_fd = -1;
+static char wear_path[4096];
+static unsigned long wear[EEPROM_PAGES];    // Page writes per page
+static double busy_until;                   // Bus time at which the running write cycle ends
+static eeprom_image_stats stats;
+
+static void bus(unsigned long bytes);
+static void ack_poll(void);
+static void page_write(unsigned long addr, const ubyte *buf, unsigned long len);
+static void sequential_read(unsigned long addr, ubyte *buf, unsigned long len);
+
+
+/**
+ * Map an image file, creating it as an erased (0xFF) device if it does not exist.
+ * @return 0 on success, -1 on error
+ */
+int eeprom_image_open(const char *path)
+{
+    struct stat st;
+    FILE *f;
+    int created;
+
+    if ((image_fd = open(path, O_RDWR | O_CREAT, 0644)) < 0 || fstat(image_fd, &st) < 0) {
+        fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    created = (st.st_size == 0);
+    if (st.st_size != EEPROM_SIZE && ftruncate(image_fd, EEPROM_SIZE) < 0) {
+        fprintf(stderr, "Error sizing %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    image = mmap(NULL, EEPROM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, image_fd, 0);
+    if (image == MAP_FAILED) {
+        image = NULL;
+        fprintf(stderr, "Error mapping %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (created) { memset(image, 0xFF, EEPROM_SIZE); }
+
+    // Wear counters of earlier runs:
+    memset(wear, 0, sizeof(wear));
+    snprintf(wear_path, sizeof(wear_path), "%s.wear", path);
+    if ((f = fopen(wear_path, "rb")) != NULL) {
+        if (fread(wear, sizeof(wear), 1, f) != 1) { memset(wear, 0, sizeof(wear)); }
+        fclose(f);
+    }
+    eeprom_image_clear_stats();
+    return 0;
+}
+
+
+/**
+ * Write the image and the wear counters back and unmap the image.
+ */
+void eeprom_image_close(void)
+{
+    FILE *f;
+
+    if (image == NULL) { return; }
+    msync(image, EEPROM_SIZE, MS_SYNC);
+    munmap(image, EEPROM_SIZE);
+    close(image_fd);
+    image = NULL;
+
+    if ((f = fopen(wear_path, "wb")) == NULL || fwrite(wear, sizeof(wear), 1, f) != 1) {
+        fprintf(stderr, "Error writing %s: %s\n", wear_path, strerror(errno));
+    }
+    if (f != NULL) { fclose(f); }
+}
+
+
+void eeprom_image_get_stats(eeprom_image_stats *s)
+{
+    *s = stats;
+}
+
+
+/**
+ * Zero the statistics and the bus time. The wear counters are kept.
+ */
+void eeprom_image_clear_stats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+    busy_until = 0;
+}
+
+
+/**
+ * @return The number of page writes to each of the EEPROM_PAGES pages
+ */
+const unsigned long *eeprom_image_wear(void)
+{
+    return wear;
+}
+
+
+/**
+ * Write any number of bytes at a 17-bit address, split into page writes like i2c_eeprom_write().
+ */
+ubyte eeprom_write(uint24 addr, const ubyte *buf, uint16 len)
+{
+    unsigned long n;
+
+    if (image == NULL || (unsigned long)addr + len > EEPROM_SIZE) { return FALSE; }
+    while (len > 0) {
+        n = EEPROM_PAGE_SIZE - addr % EEPROM_PAGE_SIZE;
+        if (n > len) { n = len; }
+        page_write(addr, buf, n);
+        addr += n;
+        buf += n;
+        len -= n;
+    }
+    return TRUE;
+}
+
+
+/**
+ * Read any number of bytes at a 17-bit address, one sequential read per block like
+ * i2c_eeprom_read().
+ */
+ubyte eeprom_read(uint24 addr, ubyte *buf, uint16 len)
+{
+    unsigned long n;
+
+    if (image == NULL || (unsigned long)addr + len > EEPROM_SIZE) { return FALSE; }
+    while (len > 0) {
+        n = I2C_24LC1026_BLOCK_SIZE - addr % I2C_24LC1026_BLOCK_SIZE;
+        if (n > len) { n = len; }
+        sequential_read(addr, buf, n);
+        addr += n;
+        buf += n;
+        len -= n;
+    }
+    return TRUE;
+}
+
+
+/**
+ * Account for a transfer of bytes between a start and a stop condition.
+ */
+static void bus(unsigned long bytes)
+{
+    stats.bus_us += (bytes * 9 + 2) * IMAGE_BIT_US;
+}
+
+
+/**
+ * Wait for a running write cycle: the device NACKs its address until the cycle is over.
+ */
+static void ack_poll(void)
+{
+    if (stats.bus_us < busy_until) {
+        stats.poll_us += busy_until - stats.bus_us;
+        stats.bus_us = busy_until;
+    }
+}
+
+
+/**
+ * Page write: control byte, two address bytes and the data. The address counter wraps around
+ * within the page.
+ */
+static void page_write(unsigned long addr, const ubyte *buf, unsigned long len)
+{
+    unsigned long page = addr - addr % EEPROM_PAGE_SIZE, i;
+
+    ack_poll();
+    bus(3 + len);
+    for (i = 0; i < len; i++) {
+        image[page + (addr + i) % EEPROM_PAGE_SIZE] = buf[i];
+    }
+    wear[page / EEPROM_PAGE_SIZE]++;
+    stats.page_writes++;
+    stats.bytes_written += len;
+    busy_until = stats.bus_us + IMAGE_WRITE_US;
+}
+
+
+/**
+ * Sequential read: control byte and two address bytes, a repeated start, the control byte and the
+ * data. The address counter wraps around within the block.
+ */
+static void sequential_read(unsigned long addr, ubyte *buf, unsigned long len)
+{
+    unsigned long block = addr - addr % I2C_24LC1026_BLOCK_SIZE, i;
+
+    ack_poll();
+    bus(3 + 1 + len);
+    for (i = 0; i < len; i++) {
+        buf[i] = image[block + (addr + i) % I2C_24LC1026_BLOCK_SIZE];
+    }
+    stats.reads++;
+    stats.bytes_read += len;
+}
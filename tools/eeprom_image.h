@@ -0,0 +1,37 @@
+/*
+ * File:   eeprom_image.h
+ * Author: Maurits
+ *
+ * Created on 17 october 2026
+ *
+ * Storage backend for host builds: a 128 KB image file of the 24LC1026, memory mapped, behind the
+ * eeprom_read() and eeprom_write() calls of eeprom.h.
+ */
+
+#ifndef EEPROM_IMAGE_H
+#define	EEPROM_IMAGE_H
+
+#include "eeprom.h"
+
+#define EEPROM_PAGES        (EEPROM_SIZE / EEPROM_PAGE_SIZE)
+
+// Timing model of the 24LC1026 on the bus at 385 kHz (SSPADD 12 @20 MHz):
+#define IMAGE_BIT_US        2.6     // One SCL period
+#define IMAGE_WRITE_US      5000.0  // Page write cycle (datasheet maximum)
+
+typedef struct {
+    double          bus_us;         // Time the bus was busy, including waits for write cycles
+    double          poll_us;        // Part of bus_us spent acknowledge polling write cycles
+    unsigned long   page_writes;    // Number of page writes
+    unsigned long   bytes_written;
+    unsigned long   reads;          // Number of sequential reads
+    unsigned long   bytes_read;
+} eeprom_image_stats;
+
+int     eeprom_image_open(const char *path);
+void    eeprom_image_close(void);
+void    eeprom_image_get_stats(eeprom_image_stats *stats);
+void    eeprom_image_clear_stats(void);
+const unsigned long *eeprom_image_wear(void);
+
+#endif	/* EEPROM_IMAGE_H */
@@ -0,0 +1,36 @@
+/*
+ * File:   host.h
+ * Author: Maurits
+ *
+ * Created on 17 october 2026
+ *
+ * Stand-ins for the XC8 and PIC18F4550 specifics used by the storage code (storage.c, record.c and
+ * util.c), so it builds with gcc on a workstation. defs.h includes this file when not compiling
+ * with XC8. See storage_bench.c.
+ */
+
+#ifndef HOST_H
+#define	HOST_H
+
+#define persistent
+#define Nop()
+#define ClrWdt()
+#define di()
+#define ei()
+#define __delay_ms(x)
+#define __delay_us(x)
+
+#define SHRTLONG_MIN        (-8388607 - 1)  // Limits of the 24-bit types on the target
+#define SHRTLONG_MAX        8388607
+
+// Registers touched by util.c, backed by dummies in the host program:
+typedef struct {
+    unsigned    TMR1IF: 1;
+    unsigned    TMR1IE: 1;
+    unsigned    TMR1ON: 1;
+} host_bits;
+
+extern volatile host_bits PIR1bits, PIE1bits, T1CONbits;
+extern volatile unsigned char T1CON, TMR1H, TMR1L;
+
+#endif	/* HOST_H */
@@ -0,0 +1,220 @@
+/*
+ * File:   storage_bench.c
+ * Author: Maurits
+ *
+ * Created on 17 october 2026
+ *
+ * Runs the telemetry log of storage.c on the host against an EEPROM image file (eeprom_image.c):
+ * logs a simulated flight, reads it back and checks every record, runs range queries through the
+ * log index, recovers the log as after a power-on reset and optionally wipes the EEPROM. Reports the bus time each step would take on
+ * the target, the host CPU time and the wear of the pages. Accesses are timed back to back, so the
+ * write cycle of a page write is waited for by whatever access follows it.
+ *
+ * Build (from the repository root):
+ *   gcc -O2 -Wall -Wno-format -I. -Itools -o storage_bench tools/storage_bench.c tools/eeprom_image.c \
+ *       storage.c record.c geo.c util.c
+ * Usage: ./storage_bench [-f format] [-n records] [-w] eeprom.bin
+ *   -f  Log format: 0 (RECORD_V1), 1 (RECORD_V2) or 2 (RECORD_DELTA, default)
+ *   -n  Number of records to log (default 3000, about a day at one record per 33 s)
+ *   -w  Wipe the EEPROM at the end
+ * The host has no 24-bit type, so record structs are larger than on the target and a page holds
+ * fewer RECORD_V1 records. Images are therefore only comparable between host runs.
+ */
+
+#include "eeprom_image.h"
+#include "storage.h"
+#include "record.h"
+#include "serial.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Stand-ins for the rest of the firmware:
+record global_config;
+volatile ubyte global_uart_rx_head, global_uart_rx_tail;
+volatile ubyte global_uart_tx_len;
+volatile host_bits PIR1bits, PIE1bits, T1CONbits;
+volatile unsigned char T1CON, TMR1H, TMR1L;
+
+void putch(ubyte c) { (void)c; }
+ubyte getc_uart(void) { return 0; }
+void write_uart(const ubyte *buf, ubyte len) { (void)buf; (void)len; }
+
+static void make_record(uint16 num, ubyte format, record *rec);
+static void report(const char *step, unsigned long n, clock_t start);
+static void bench_query(uint16 oldest, uint16 last, uint32 t0, uint32 t1, sint32 a0, sint32 a1, const char *step);
+
+
+int main(int argc, char **argv)
+{
+    record rec, saved;
+    unsigned long records = 3000, bad = 0, i;
+    const unsigned long *wear;
+    unsigned long log_max = 0, log_total = 0, cj_max = 0;
+    uint16 oldest, last;
+    int format = RECORD_DELTA, wipe = 0, opt;
+    clock_t start;
+
+    while ((opt = getopt(argc, argv, "f:n:w")) != -1) {
+        switch (opt) {
+            case 'f': format = atoi(optarg); break;
+            case 'n': records = strtoul(optarg, NULL, 10); break;
+            case 'w': wipe = 1; break;
+            default: optind = argc + 1; break;
+        }
+    }
+    if (optind != argc - 1 || format < RECORD_V1 || format > RECORD_DELTA || records < 1 || records > MAX_RECORD) {
+        fprintf(stderr, "Usage: %s [-f format] [-n records] [-w] <image file>\n", argv[0]);
+        return 1;
+    }
+    if (eeprom_image_open(argv[optind]) < 0) { return 1; }
+
+    // 1. Log a flight, saving the config with every record like the flight loop does:
+    init_storage(TRUE);
+    printf("\n");
+    eeprom_image_clear_stats();
+    start = clock();
+    start_log((ubyte)format);
+    for (i = 1; i <= records; i++) {
+        make_record((uint16)i, (ubyte)format, &rec);
+        global_config.ru.config.last_record = (uint16)i;
+        if (!save_record((uint16)i, &rec) || !save_config()) {
+            fprintf(stderr, "Error saving record %lu\n", i);
+            return 1;
+        }
+    }
+    flush_records();
+    report("save + config", records, start);
+
+    // 2. Read back every record still in the ring:
+    eeprom_image_clear_stats();
+    start = clock();
+    oldest_record(&oldest);
+    last = global_config.ru.config.last_record;
+    for (i = oldest; i <= last; i++) {
+        make_record((uint16)i, (ubyte)format, &saved);
+        if (!retr_record((uint16)i, &rec) || memcmp(&rec, &saved, sizeof(record)) != 0) { bad++; }
+    }
+    report("retr", last - oldest + 1, start);
+    printf("  records %u - %u in the ring, %lu do not match\n", oldest, last, bad);
+
+    // 3. Range queries through the index, checked against the records read back above:
+    bench_query(oldest, last, 0, SHRTLONG_MAX, 25000, SHRTLONG_MAX, "query alt");
+    make_record((uint16)(oldest + (last - oldest) / 2), (ubyte)format, &saved);
+    bench_query(oldest, last, record_time(&saved), record_time(&saved) + 599, SHRTLONG_MIN, SHRTLONG_MAX, "query time");
+
+    // 4. Recover the log as after a power-on reset:
+    eeprom_image_clear_stats();
+    start = clock();
+    init_storage(TRUE);
+    printf("\n");
+    report("recovery", 1, start);
+    if (global_config.ru.config.last_record != last) {
+        printf("  recovered up to record %u instead of %u\n", global_config.ru.config.last_record, last);
+        bad++;
+    }
+
+    // 5. Wipe:
+    if (wipe) {
+        eeprom_image_clear_stats();
+        start = clock();
+        if (!wipe_storage(0xFF)) { bad++; }
+        report("wipe", 1, start);
+    }
+
+    // Wear of the configuration journal and of the log pages:
+    wear = eeprom_image_wear();
+    for (i = 0; i < EEPROM_PAGES; i++) {
+        if (i < LOG_FIRST_PAGE) {
+            if (wear[i] > cj_max) { cj_max = wear[i]; }
+        }
+        else {
+            if (wear[i] > log_max) { log_max = wear[i]; }
+            log_total += wear[i];
+        }
+    }
+    printf("Wear (all runs on this image): config journal max %lu writes/page, log max %lu, mean %.1f writes/page\n",
+           cj_max, log_max, (double)log_total / LOG_PAGES);
+
+    eeprom_image_close();
+    return bad ? 2 : 0;
+}
+
+
+/**
+ * Telemetry record number num of a simulated flight: one record per 33 seconds, ascending at
+ * 5 m/s while drifting east. Records in the packed formats are stored with less precision, so the
+ * record is normalized through a record_v2 for those.
+ */
+static void make_record(uint16 num, ubyte format, record *rec)
+{
+    unsigned long t = 10UL * 3600 + (unsigned long)num * 33;
+    record_v2 v2;
+
+    memset(rec, 0, sizeof(record));
+    rec->status.ascending = 1;
+    rec->status.moving = 1;
+    rec->status.gps_lock = 1;
+    rec->ru.telemetry.hours = (ubyte)(t / 3600 % 24);
+    rec->ru.telemetry.minutes = (ubyte)(t / 60 % 60);
+    rec->ru.telemetry.seconds = (ubyte)(t % 60);
+    rec->ru.telemetry.days = (ubyte)(t / 86400);
+    rec->ru.telemetry.pressure = 101325 - (num * 165) % 100000;
+    rec->ru.telemetry.alt_gps = (num * 165) % 40000;
+    rec->ru.telemetry.status2.baro_digi = 1;
+    rec->ru.telemetry.status2.gps_stale = (num % 7 == 0);
+    rec->ru.telemetry.latitude = 52116660L + (num * 37L) % 5000 * 10;
+    rec->ru.telemetry.longitude = 4500000L + (num * 61L) % 590000 * 10;
+
+    if (format != RECORD_V1) {
+        pack_record_v2(rec, &v2);
+        unpack_record_v2(&v2, rec);
+    }
+}
+
+
+/**
+ * Run a range query and check that it finds exactly the records in range.
+ */
+static void bench_query(uint16 oldest, uint16 last, uint32 t0, uint32 t1, sint32 a0, sint32 a1, const char *step)
+{
+    log_query q;
+    record rec;
+    unsigned long expected = 0, found = 0, wrong = 0, i;
+    uint16 num;
+    clock_t start;
+
+    for (i = oldest; i <= last; i++) {
+        if (retr_record((uint16)i, &rec) && record_time(&rec) >= t0 && record_time(&rec) <= t1 && \
+                rec.ru.telemetry.alt_gps >= a0 && rec.ru.telemetry.alt_gps <= a1) { expected++; }
+    }
+
+    memset(&q, 0, sizeof(q));
+    q.time_from = t0;
+    q.time_to = t1;
+    q.alt_from = a0;
+    q.alt_to = a1;
+    eeprom_image_clear_stats();
+    start = clock();
+    query_log(&q);
+    while (query_next(&q, &num, &rec)) {
+        found++;
+        if (record_time(&rec) < t0 || record_time(&rec) > t1 || rec.ru.telemetry.alt_gps < a0 || rec.ru.telemetry.alt_gps > a1) { wrong++; }
+    }
+    report(step, 1, start);
+    printf("  %lu records found (%lu expected, %lu out of range), %u log pages read\n", found, expected, wrong, q.pages);
+}
+
+
+static void report(const char *step, unsigned long n, clock_t start)
+{
+    eeprom_image_stats s;
+    double cpu_us = (double)(clock() - start) * 1e6 / CLOCKS_PER_SEC;
+
+    eeprom_image_get_stats(&s);
+    printf("%-14s bus %9.1f ms (%7.1f ms polling), %6.1f us/op on the bus, %6.2f us/op host CPU | %5lu page writes, %6lu reads, %7lu bytes read\n",
+           step, s.bus_us / 1000, s.poll_us / 1000, s.bus_us / n, cpu_us / n, s.page_writes, s.reads, s.bytes_read);
+}
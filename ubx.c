@@ -0,0 +1,322 @@
+/*
+ * File:   ubx.c
+ * Author: Maurits
+ *
+ * Created on 17 october 2026
+ *
+ * Driver for the UBX binary protocol of u-blox GPS receivers: switches the receiver to the
+ * airborne dynamic model (without it, fixes stop above 18 km) and from NMEA to NAV-PVT messages.
+ * NAV-PVT is parsed one byte at a time as well, but only the bytes of the fields used are kept:
+ * they land in place in the integer fields of a little-endian struct, no text is converted.
+ */
+
+#include "ubx.h"
+#include "serial.h"
+#include "util.h"
+
+#include <limits.h>
+#include <string.h>
+
+
+// States of the UBX parser:
+#define UBX_ST_SYNC1    0
+#define UBX_ST_SYNC2    1
+#define UBX_ST_CLASS    2
+#define UBX_ST_ID       3
+#define UBX_ST_LEN1     4
+#define UBX_ST_LEN2     5
+#define UBX_ST_PAYLOAD  6
+#define UBX_ST_CK_A     7
+#define UBX_ST_CK_B     8
+
+#define UBX_PVT_LEN     92
+
+// NAV-PVT flags:
+#define PVT_VALID_DATE  0x01
+#define PVT_VALID_TIME  0x02
+#define PVT_GNSS_FIX_OK 0x01
+
+uint16 global_ubx_checksum_errors;
+
+static void  ubx_send(ubyte cls, ubyte id, const ubyte *payload, ubyte len);
+static void  ubx_putc(ubyte c, ubyte *ck_a, ubyte *ck_b);
+static ubyte ubx_wait_ack(ubyte cls, ubyte id);
+static void  pvt_byte(ubyte c);
+static void  pvt_fix(gps_fix *fix);
+
+// The fields of NAV-PVT that are used, in message order. The bytes of each run of fields are
+// stored at their offset from the start of the run, so the integers assemble themselves.
+static struct {
+    uint16      year;               // 4 - 11
+    ubyte       month;
+    ubyte       day;
+    ubyte       hour;
+    ubyte       min;
+    ubyte       sec;
+    ubyte       valid;
+    ubyte       fix_type;           // 20 - 39
+    ubyte       flags;
+    ubyte       flags2;
+    ubyte       num_sv;
+    sint32      lon;                // 1e-7 degrees
+    sint32      lat;                // 1e-7 degrees
+    sint32      height;             // mm above the ellipsoid
+    sint32      h_msl;              // mm above mean sea level
+    sint32      vel_d;              // 56 - 67: mm/s down
+    sint32      g_speed;            // mm/s
+    sint32      head_mot;           // 1e-5 degrees
+    uint16      p_dop;              // 76 - 77: 0.01
+} pvt;
+
+// Parser state:
+static struct {
+    ubyte       state;              // UBX_ST_*
+    ubyte       cls;
+    ubyte       id;
+    uint16      len;                // Payload length
+    uint16      pos;                // Payload bytes received
+    ubyte       ck_a;               // Fletcher checksum so far
+    ubyte       ck_b;
+    ubyte       ack[2];             // Class and id of the message an ACK refers to
+} ubx;
+
+
+/**
+ * Configure the u-blox receiver for flight: the airborne < 1g dynamic model, a NAV-PVT message
+ * each navigation epoch, and UBX only on the UART (NMEA output off). NMEA output is only turned off
+ * once the rest has been acknowledged, so a receiver without NAV-PVT (such as a u-blox 6) keeps
+ * talking NMEA. The settings are saved, so they survive a loss of power where the receiver has
+ * battery backed RAM or flash. The GPS channel must be selected.
+ * @return True iff the receiver acknowledged the dynamic model and the NAV-PVT rate
+ */
+ubyte ubx_configure(void)
+{
+    ubyte buf[36];
+    ubyte ok;
+
+    // CFG-NAV5: apply only the dynamic model (mask bit 0):
+    memset(buf, 0, sizeof(buf));
+    buf[0] = 0x01;
+    buf[2] = UBX_NAV5_AIRBORNE_1G;
+    ubx_send(UBX_CLASS_CFG, UBX_CFG_NAV5, buf, 36);
+    ok = ubx_wait_ack(UBX_CLASS_CFG, UBX_CFG_NAV5);
+
+    // CFG-MSG: NAV-PVT every navigation epoch on the current port:
+    buf[0] = UBX_CLASS_NAV;
+    buf[1] = UBX_NAV_PVT;
+    buf[2] = 1;
+    ubx_send(UBX_CLASS_CFG, UBX_CFG_MSG, buf, 3);
+    ok = ubx_wait_ack(UBX_CLASS_CFG, UBX_CFG_MSG) && ok;
+    if (!ok) { return FALSE; }
+
+    // CFG-PRT: UART1 at 9600 baud 8N1, UBX and NMEA in, UBX out. The ACK may get lost in the switch:
+    memset(buf, 0, sizeof(buf));
+    buf[0] = 1;                     // Port id
+    buf[4] = 0xD0; buf[5] = 0x08;   // Mode: 8 bits, no parity, 1 stop bit
+    buf[8] = (ubyte)9600; buf[9] = (ubyte)(9600 >> 8);
+    buf[12] = 0x03;                 // In: UBX and NMEA
+    buf[14] = 0x01;                 // Out: UBX
+    ubx_send(UBX_CLASS_CFG, UBX_CFG_PRT, buf, 20);
+    ubx_wait_ack(UBX_CLASS_CFG, UBX_CFG_PRT);
+
+    // CFG-CFG: save the port, message and navigation settings to battery backed RAM, flash and EEPROM:
+    memset(buf, 0, sizeof(buf));
+    buf[4] = 0x0B;                  // Save mask: ioPort, msgConf and navConf
+    buf[12] = 0x07;                 // Devices: BBR, flash and EEPROM
+    ubx_send(UBX_CLASS_CFG, UBX_CFG_CFG, buf, 13);
+    ubx_wait_ack(UBX_CLASS_CFG, UBX_CFG_CFG);
+    return TRUE;
+}
+
+
+/**
+ * Switch the receiver between continuous tracking and power save mode, in which it tracks in
+ * cycles and sleeps in between. The GPS channel must be selected.
+ * @param on True for power save mode, false for continuous tracking
+ * @return True iff the receiver acknowledged the mode
+ */
+ubyte ubx_power_save(ubyte on)
+{
+    ubyte buf[2];
+
+    buf[0] = 8;                     // Reserved, must be 8
+    buf[1] = on ? 1 : 0;            // Low power mode
+    ubx_send(UBX_CLASS_CFG, UBX_CFG_RXM, buf, 2);
+    return ubx_wait_ack(UBX_CLASS_CFG, UBX_CFG_RXM);
+}
+
+
+/**
+ * Put the receiver in backup mode until it is woken by activity on its UART (see gps_wake()).
+ * The receiver does not acknowledge this. The GPS channel must be selected.
+ */
+void ubx_backup(void)
+{
+    ubyte buf[8];
+
+    memset(buf, 0, sizeof(buf));    // Duration 0: until woken
+    buf[4] = 0x02;                  // Flags: backup
+    ubx_send(UBX_CLASS_RXM, UBX_RXM_PMREQ, buf, 8);
+}
+
+
+/**
+ * Feed a received byte to the UBX parser.
+ * @param c The byte
+ * @param fix Fix that receives a NAV-PVT solution once its checksum has been verified
+ * @return The message (UBX_PVT ...) that c completed, UBX_NONE if none
+ */
+ubyte ubx_parse(ubyte c, gps_fix *fix)
+{
+    if (ubx.state >= UBX_ST_CLASS && ubx.state <= UBX_ST_PAYLOAD) {
+        ubx.ck_a += c;
+        ubx.ck_b += ubx.ck_a;
+    }
+
+    switch (ubx.state) {
+        case UBX_ST_SYNC1:
+            if (c == UBX_SYNC1) { ubx.state = UBX_ST_SYNC2; }
+            break;
+        case UBX_ST_SYNC2:
+            if (c == UBX_SYNC2) {
+                ubx.state = UBX_ST_CLASS;
+                ubx.ck_a = 0;
+                ubx.ck_b = 0;
+            }
+            else { ubx.state = (c == UBX_SYNC1) ? UBX_ST_SYNC2 : UBX_ST_SYNC1; }
+            break;
+        case UBX_ST_CLASS:
+            ubx.cls = c;
+            ubx.state = UBX_ST_ID;
+            break;
+        case UBX_ST_ID:
+            ubx.id = c;
+            ubx.state = UBX_ST_LEN1;
+            break;
+        case UBX_ST_LEN1:
+            ubx.len = c;
+            ubx.state = UBX_ST_LEN2;
+            break;
+        case UBX_ST_LEN2:
+            ubx.len |= (uint16)c << 8;
+            ubx.pos = 0;
+            ubx.state = (ubx.len == 0) ? UBX_ST_CK_A : UBX_ST_PAYLOAD;
+            break;
+        case UBX_ST_PAYLOAD:
+            if (ubx.cls == UBX_CLASS_NAV && ubx.id == UBX_NAV_PVT) { pvt_byte(c); }
+            else if (ubx.cls == UBX_CLASS_ACK && ubx.pos < 2) { ubx.ack[ubx.pos] = c; }
+            if (++ubx.pos == ubx.len) { ubx.state = UBX_ST_CK_A; }
+            break;
+        case UBX_ST_CK_A:
+            ubx.state = (c == ubx.ck_a) ? UBX_ST_CK_B : UBX_ST_SYNC1;
+            if (c != ubx.ck_a) { global_ubx_checksum_errors++; }
+            break;
+        case UBX_ST_CK_B:
+            ubx.state = UBX_ST_SYNC1;
+            if (c != ubx.ck_b) {
+                global_ubx_checksum_errors++;
+                break;
+            }
+            if (ubx.cls == UBX_CLASS_NAV && ubx.id == UBX_NAV_PVT && ubx.len == UBX_PVT_LEN) {
+                pvt_fix(fix);
+                return UBX_PVT;
+            }
+            if (ubx.cls == UBX_CLASS_ACK) { return (ubx.id == UBX_ACK_ACK) ? UBX_ACK : UBX_NAK; }
+            break;
+        default:
+            ubx.state = UBX_ST_SYNC1;
+            break;
+    }
+    return UBX_NONE;
+}
+
+
+/**
+ * Keep a payload byte of NAV-PVT if it belongs to a field that is used.
+ */
+static void pvt_byte(ubyte c)
+{
+    uint16 p = ubx.pos;
+
+    if (p >= 4 && p < 12) { ((ubyte *)&pvt.year)[p - 4] = c; }
+    else if (p >= 20 && p < 40) { ((ubyte *)&pvt.fix_type)[p - 20] = c; }
+    else if (p >= 56 && p < 68) { ((ubyte *)&pvt.vel_d)[p - 56] = c; }
+    else if (p >= 76 && p < 78) { ((ubyte *)&pvt.p_dop)[p - 76] = c; }
+}
+
+
+/**
+ * Convert the NAV-PVT fields to a fix.
+ */
+static void pvt_fix(gps_fix *fix)
+{
+    memset(fix, '\0', sizeof(gps_fix));
+    fix->sentences = NMEA_EPOCH;        // A NAV-PVT holds all there is in an epoch
+    if (pvt.valid & PVT_VALID_TIME) {
+        fix->hours = pvt.hour;
+        fix->minutes = pvt.min;
+        fix->seconds = pvt.sec;
+    }
+    if ((pvt.valid & PVT_VALID_DATE) && pvt.year >= 2000) {
+        fix->day = pvt.day;
+        fix->month = pvt.month;
+        fix->year = (ubyte)(pvt.year - 2000);
+    }
+    if ((pvt.flags & PVT_GNSS_FIX_OK) && pvt.fix_type >= 2 && pvt.fix_type <= 4) { fix->quality = 1; }
+    fix->satellites = pvt.num_sv;
+    fix->hdop = pvt.p_dop / 10;         // NAV-PVT only has the position DOP
+    fix->latitude = (pvt.lat >= 0) ? (pvt.lat + 5) / 10 : (pvt.lat - 5) / 10;
+    fix->longitude = (pvt.lon >= 0) ? (pvt.lon + 5) / 10 : (pvt.lon - 5) / 10;
+    fix->altitude = (sint24)(pvt.h_msl / 1000);
+    fix->speed = (pvt.g_speed > 655350) ? USHRT_MAX : (uint16)(pvt.g_speed / 10);
+    fix->course = (uint16)(pvt.head_mot / 10000);
+    fix->climb = (sint16)(-pvt.vel_d / 10);
+}
+
+
+/**
+ * Send a UBX message to the GPS.
+ */
+static void ubx_send(ubyte cls, ubyte id, const ubyte *payload, ubyte len)
+{
+    ubyte ck_a = 0, ck_b = 0, i;
+
+    putch(UBX_SYNC1);
+    putch(UBX_SYNC2);
+    ubx_putc(cls, &ck_a, &ck_b);
+    ubx_putc(id, &ck_a, &ck_b);
+    ubx_putc(len, &ck_a, &ck_b);
+    ubx_putc(0, &ck_a, &ck_b);
+    for (i = 0; i < len; i++) { ubx_putc(payload[i], &ck_a, &ck_b); }
+    putch(ck_a);
+    putch(ck_b);
+}
+
+
+static void ubx_putc(ubyte c, ubyte *ck_a, ubyte *ck_b)
+{
+    putch(c);
+    *ck_a += c;
+    *ck_b += *ck_a;
+}
+
+
+/**
+ * Wait for the receiver to acknowledge a configuration message.
+ * @return True iff it was acknowledged (ACK-ACK) before UBX_ACK_TIMEOUT_MS
+ */
+static ubyte ubx_wait_ack(ubyte cls, ubyte id)
+{
+    gps_fix fix;
+    uint16 start = ms_ticks();
+    ubyte m;
+
+    while (ms_since(start) < UBX_ACK_TIMEOUT_MS) {
+        if (!data_rdy_uart()) { continue; }
+        m = ubx_parse(getc_uart(), &fix);
+        if ((m == UBX_ACK || m == UBX_NAK) && ubx.ack[0] == cls && ubx.ack[1] == id) {
+            return (m == UBX_ACK);
+        }
+    }
+    return FALSE;
+}
@@ -0,0 +1,62 @@
+/*
+ * File:   ubx.h
+ * Author: Maurits
+ *
+ * Created on 17 october 2026
+ *
+ * Driver for the UBX binary protocol of u-blox GPS receivers.
+ */
+
+#ifndef UBX_H
+#define	UBX_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include "defs.h"
+#include "gps.h"
+
+// Frame: UBX_SYNC1, UBX_SYNC2, class, id, payload length (2 bytes, LSB first), payload and the
+// 8-bit Fletcher checksum (CK_A, CK_B) over class, id, length and payload.
+#define UBX_SYNC1           0xB5
+#define UBX_SYNC2           0x62
+
+// Messages used:
+#define UBX_CLASS_NAV       0x01
+#define UBX_CLASS_RXM       0x02
+#define UBX_CLASS_ACK       0x05
+#define UBX_CLASS_CFG       0x06
+#define UBX_NAV_PVT         0x07    // Position, velocity and time solution (92 bytes)
+#define UBX_RXM_PMREQ       0x41    // Power management request (backup mode)
+#define UBX_ACK_NAK         0x00
+#define UBX_ACK_ACK         0x01
+#define UBX_CFG_PRT         0x00    // Port configuration
+#define UBX_CFG_MSG         0x01    // Message rate
+#define UBX_CFG_CFG         0x09    // Save the configuration
+#define UBX_CFG_RXM         0x11    // Receiver power mode
+#define UBX_CFG_NAV5        0x24    // Navigation engine settings
+
+#define UBX_NAV5_AIRBORNE_1G    6   // Dynamic model: airborne with < 1g acceleration (up to 50 km)
+#define UBX_ACK_TIMEOUT_MS      1000
+
+// Messages recognized by ubx_parse():
+#define UBX_NONE            0
+#define UBX_PVT             1       // NAV-PVT, parsed into the fix
+#define UBX_ACK             2       // ACK-ACK
+#define UBX_NAK             3       // ACK-NAK
+
+// Global variables:
+extern uint16 global_ubx_checksum_errors;   // UBX messages with a checksum that does not match
+
+// Prototypes
+ubyte ubx_configure(void);
+ubyte ubx_power_save(ubyte on);
+void  ubx_backup(void);
+ubyte ubx_parse(ubyte c, gps_fix *fix);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* UBX_H */
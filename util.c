@@ -11,6 +11,10 @@
 #include <string.h>
 
 
+// Global variables
+volatile uint16 global_ms_ticks;        // Milliseconds since init_ticks(), wraps around
+
+
 // Alternative gets() implementation. Reads from the USART and outputs the characters into
 // the specified array until one of two conditions arises:
 // 1) The given buffer is full
@@ -73,3 +77,140 @@ void delay_1sec(void)
         __delay_ms(10);
     }
 }
+
+
+/**
+ * Start the millisecond tick on Timer1. The tick is used for deadlines, not for exact timing.
+ */
+void init_ticks(void)
+{
+    T1CON = 0xB0;               // 16-bit reads/writes, 1:8 prescaler, internal clock (Fosc/4), stopped
+    TMR1H = TICK_RELOAD >> 8;   // Writing TMR1L loads TMR1H as well
+    TMR1L = TICK_RELOAD & 0xff;
+    global_ms_ticks = 0;
+    PIR1bits.TMR1IF = CLEAR;
+    PIE1bits.TMR1IE = SET;
+    T1CONbits.TMR1ON = SET;
+}
+
+
+/**
+ * Read the millisecond tick. Do not call with interrupts disabled, it enables them again.
+ * @return Milliseconds since init_ticks(), wrapping around after 65 seconds
+ */
+uint16 ms_ticks(void)
+{
+    uint16 t;
+
+    di();                       // The ISR may update the tick between reading its two bytes
+    t = global_ms_ticks;
+    ei();
+    return t;
+}
+
+
+/**
+ * Timer1 interrupt: reload the timer for the next millisecond and advance the tick.
+ */
+void ticks_isr(void)
+{
+    TMR1H = TICK_RELOAD >> 8;
+    TMR1L = TICK_RELOAD & 0xff;
+    PIR1bits.TMR1IF = CLEAR;
+    global_ms_ticks++;
+}
+
+
+/**
+ * Update a CRC16 (XMODEM polynomial 0x1021) with a single byte.
+ * @param crc The CRC so far
+ * @param data The byte to add
+ * @return The updated CRC
+ */
+uint16 crc16_update(uint16 crc, ubyte data)
+{
+    ubyte i;
+    
+    crc = crc ^ ((uint16)data << 8);
+    
+    for (i = 0; i < 8; i++) {
+        if (crc & 0x8000) {
+            crc = (crc << 1) ^ 0x1021;
+        } else {
+            crc <<= 1;
+        }
+    }
+    
+    return crc;
+}
+
+
+/**
+ * Calculate the CRC16 of a buffer (initial value 0xffff).
+ * @param buf The buffer
+ * @param len Number of bytes in the buffer
+ * @return The CRC16 of the buffer
+ */
+uint16 crc16_block(const ubyte *buf, uint16 len)
+{
+    uint16 i, crc = 0xffff;
+
+    for (i = 0; i < len; i++) {
+        crc = crc16_update(crc, buf[i]);
+    }
+    return crc;
+}
+
+
+/**
+ * Store the lower n bits of a value in a bit stream, most significant bit first.
+ * @param buf The bit stream
+ * @param pos Bit position (counted from the MSB of the first byte) to store the value at
+ * @param n Number of bits (1 - 32)
+ * @param value The value to store
+ */
+void put_bits(ubyte *buf, uint16 pos, ubyte n, uint32 value)
+{
+    uint32 bit;
+
+    for (bit = (uint32)1 << (n - 1); bit != 0; bit >>= 1, pos++) {
+        if (value & bit) { buf[pos >> 3] |= (ubyte)(0x80 >> (pos & 7)); }
+        else { buf[pos >> 3] &= (ubyte)~(0x80 >> (pos & 7)); }
+    }
+}
+
+
+/**
+ * Retrieve an unsigned value of n bits from a bit stream.
+ * @param buf The bit stream
+ * @param pos Bit position of the value
+ * @param n Number of bits (1 - 32)
+ * @return The value
+ */
+uint32 get_bits(const ubyte *buf, uint16 pos, ubyte n)
+{
+    uint32 value = 0;
+
+    for (; n > 0; n--, pos++) {
+        value <<= 1;
+        if (buf[pos >> 3] & (ubyte)(0x80 >> (pos & 7))) { value |= 1; }
+    }
+    return value;
+}
+
+
+/**
+ * Retrieve a two's complement value of n bits from a bit stream and sign-extend it.
+ * @param buf The bit stream
+ * @param pos Bit position of the value
+ * @param n Number of bits (1 - 31)
+ * @return The value
+ */
+sint32 get_sbits(const ubyte *buf, uint16 pos, ubyte n)
+{
+    uint32 value;
+
+    value = get_bits(buf, pos, n);
+    if (value & ((uint32)1 << (n - 1))) { value |= ~(((uint32)1 << n) - 1); }
+    return (sint32)value;
+}
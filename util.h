@@ -14,9 +14,27 @@ extern "C" {
 
 #include "defs.h"
 
+// Millisecond tick on Timer1: Fosc/4 with a 1:8 prescaler counts 625 times per millisecond
+#define TICKS_PER_MS        625
+#define TICK_RELOAD         (65536 - TICKS_PER_MS)
+
+// Milliseconds passed since a tick count, valid for up to 65 seconds:
+#define ms_since(t)         ((uint16)(ms_ticks() - (t)))
+
+// Global variables:
+extern volatile uint16 global_ms_ticks;
+
 void alt_gets(ubyte *buf, ubyte buf_size);
 void alt_gets_no_echo(ubyte *buf, ubyte buf_size);
 void delay_1sec(void);
+void   init_ticks(void);
+uint16 ms_ticks(void);
+void   ticks_isr(void);
+uint16 crc16_update(uint16 crc, ubyte data);
+uint16 crc16_block(const ubyte *buf, uint16 len);
+void   put_bits(ubyte *buf, uint16 pos, ubyte n, uint32 value);
+uint32 get_bits(const ubyte *buf, uint16 pos, ubyte n);
+sint32 get_sbits(const ubyte *buf, uint16 pos, ubyte n);
 
 
 #ifdef	__cplusplus